@@ -0,0 +1,11 @@
+#pragma once
+
+// Micro-benchmarks of the label pipeline. The niimbot-client-benchmark
+// environment (NIIMBOT_BENCHMARK) reports them over Serial before the printer
+// is contacted; native-benchmark runs them on the host (test/test_benchmarks).
+void runBenchmarks();
+
+// Single groups, for host runs
+void benchmarkRowEncoder();
+void benchmarkTextRenderer();
+void benchmarkBarcodes();
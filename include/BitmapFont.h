@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+
+// Fixed-width font stored column by column, least significant bit at the
+// top, as in the classic 5x7 LCD fonts. The tables live in flash.
+struct BitmapFont
+{
+  uint8_t width;
+  uint8_t height;
+  char firstCharacter;
+  char lastCharacter;
+  const uint8_t *columns;
+};
+
+namespace Fonts
+{
+  extern const BitmapFont FONT_5X7;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+
+// Lock-free single-producer/single-consumer byte ring. One context may call
+// write() while another reads through peek()/contiguous()/consume().
+template <size_t Capacity>
+class ByteRing
+{
+  static_assert(Capacity != 0 && (Capacity & (Capacity - 1)) == 0, "ByteRing capacity must be a power of two");
+
+public:
+  ByteRing() : head(0), tail(0) {}
+
+  // Producer side. Returns how many bytes fitted; the rest are dropped.
+  size_t write(const uint8_t *data, size_t length)
+  {
+    size_t writeIndex = tail.load(std::memory_order_relaxed);
+    size_t freeSpace = Capacity - (writeIndex - head.load(std::memory_order_acquire));
+
+    if (length > freeSpace)
+    {
+      length = freeSpace;
+    }
+
+    size_t offset = writeIndex & MASK;
+    size_t firstPart = length < Capacity - offset ? length : Capacity - offset;
+
+    memcpy(storage + offset, data, firstPart);
+    memcpy(storage, data + firstPart, length - firstPart);
+
+    tail.store(writeIndex + length, std::memory_order_release);
+    return length;
+  }
+
+  // Consumer side
+  size_t available() const
+  {
+    return tail.load(std::memory_order_acquire) - head.load(std::memory_order_relaxed);
+  }
+
+  uint8_t peek(size_t offset) const
+  {
+    return storage[(head.load(std::memory_order_relaxed) + offset) & MASK];
+  }
+
+  // Points straight into the ring when the requested bytes do not wrap,
+  // nullptr otherwise.
+  const uint8_t *contiguous(size_t offset, size_t length) const
+  {
+    size_t start = (head.load(std::memory_order_relaxed) + offset) & MASK;
+
+    return start + length <= Capacity ? storage + start : nullptr;
+  }
+
+  void copyOut(size_t offset, uint8_t *out, size_t length) const
+  {
+    for (size_t i = 0; i < length; ++i)
+    {
+      out[i] = peek(offset + i);
+    }
+  }
+
+  void consume(size_t count)
+  {
+    head.store(head.load(std::memory_order_relaxed) + count, std::memory_order_release);
+  }
+
+  static constexpr size_t capacity() { return Capacity; }
+
+private:
+  static const size_t MASK = Capacity - 1;
+
+  std::atomic<size_t> head;
+  std::atomic<size_t> tail;
+  uint8_t storage[Capacity];
+};
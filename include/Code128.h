@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "RowSource.h"
+
+// Code 128 symbol encoder. Uses code set B for text and switches to code set
+// C for runs of digits, which packs two digits per symbol.
+class Code128
+{
+public:
+  static const size_t MAX_SYMBOLS = 48;
+  static const uint8_t QUIET_ZONE_MODULES = 10;
+
+  Code128() : symbolCount(0) {}
+
+  // Returns false if the text holds characters outside code set B or does
+  // not fit in MAX_SYMBOLS
+  bool encode(const char *text);
+
+  // Including both quiet zones
+  uint16_t moduleCount() const;
+
+  // ORs the bars into `row`, starting at pixel `x` with the leading quiet zone
+  void renderRow(uint16_t x, uint8_t moduleWidth, uint8_t *row, size_t rowBytes) const;
+
+private:
+  bool push(uint8_t value);
+
+  uint8_t symbols[MAX_SYMBOLS];
+  size_t symbolCount;
+};
+
+// A barcode's rows are all identical; the row is rendered once and returned
+// for every scanline of the bar, so the encoder collapses it into a repeat.
+class Code128RowSource : public RowSource
+{
+public:
+  Code128RowSource(const Code128 &barcode, uint16_t x, uint16_t y, uint8_t moduleWidth, uint16_t barHeight, uint16_t width, uint16_t height);
+
+  uint16_t width() const override { return columns; }
+  uint16_t height() const override { return rows; }
+  RowSpan renderRow(uint16_t y, uint8_t *scratch) override;
+
+private:
+  uint8_t barRow[MAX_ROW_BYTES];
+  uint16_t top;
+  uint16_t barHeight;
+  uint16_t columns;
+  uint16_t rows;
+};
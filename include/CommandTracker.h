@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ResponseDecoder.h"
+
+#ifndef NIIMBOT_MAX_IN_FLIGHT_COMMANDS
+#define NIIMBOT_MAX_IN_FLIGHT_COMMANDS 4
+#endif
+
+enum class CommandResult
+{
+  Completed,
+  Rejected,
+  TimedOut
+};
+
+// `response` is empty when the command timed out
+typedef void (*CommandCallback)(CommandResult result, const PrinterResponse &response, void *context);
+
+// Matches printer responses to the commands that caused them. Up to
+// MAX_IN_FLIGHT commands may be outstanding at once; responses resolve the
+// oldest outstanding command they answer. Error replies reject the most
+// recently sent command other than a heartbeat or status poll.
+class CommandTracker
+{
+public:
+  static const size_t MAX_IN_FLIGHT = NIIMBOT_MAX_IN_FLIGHT_COMMANDS;
+
+  CommandTracker() : nextSequence(0), count(0) {}
+
+  bool track(uint8_t commandCode, CommandCallback callback, void *context, uint32_t now, uint32_t timeoutMs);
+
+  // Returns false when no outstanding command was waiting for this response
+  bool resolve(const PrinterResponse &response);
+
+  void expire(uint32_t now);
+
+  // Forgets every outstanding command without calling back, for when the
+  // link they were sent on is gone
+  void cancelAll();
+
+  bool isTracking(uint8_t commandCode) const;
+
+  size_t inFlight() const { return count; }
+  bool full() const { return count == MAX_IN_FLIGHT; }
+
+private:
+  struct PendingCommand
+  {
+    bool active;
+    uint8_t commandCode;
+    uint32_t sequence;
+    uint32_t deadline;
+    CommandCallback callback;
+    void *context;
+  };
+
+  void complete(size_t index, CommandResult result, const PrinterResponse &response);
+
+  PendingCommand pending[MAX_IN_FLIGHT] = {};
+  uint32_t nextSequence;
+  size_t count;
+};
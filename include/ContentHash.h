@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 64-bit FNV-1a over whatever determines a label's output: its content, its
+// layout and the print settings. Cheap enough to run on every print, long
+// enough that two different labels never share a cache entry in practice.
+class ContentHash
+{
+public:
+  static const uint64_t OFFSET_BASIS = 0xCBF29CE484222325ULL;
+  static const uint64_t PRIME = 0x00000100000001B3ULL;
+
+  ContentHash() : value(OFFSET_BASIS) {}
+
+  ContentHash &add(const void *data, size_t length)
+  {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+    for (size_t i = 0; i < length; ++i)
+    {
+      value = (value ^ bytes[i]) * PRIME;
+    }
+
+    return *this;
+  }
+
+  // Fixed width and byte order, so keys survive a change of compiler
+  ContentHash &addValue(uint32_t number)
+  {
+    const uint8_t bytes[] = {
+        static_cast<uint8_t>(number >> 24), static_cast<uint8_t>(number >> 16),
+        static_cast<uint8_t>(number >> 8), static_cast<uint8_t>(number)};
+
+    return add(bytes, sizeof(bytes));
+  }
+
+  uint64_t digest() const { return value; }
+
+private:
+  uint64_t value;
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+
+#include "RowSource.h"
+
+// 8-bit grayscale rows, 0 is black and 255 is white. Sources that decode on
+// the fly write into `scratch` (at least width() bytes) and return it;
+// sources backed by memory may return a pointer into their own storage.
+class GrayscaleSource
+{
+public:
+  virtual ~GrayscaleSource() {}
+
+  virtual uint16_t width() const = 0;
+  virtual uint16_t height() const = 0;
+  virtual const uint8_t *grayRow(uint16_t y, uint8_t *scratch) = 0;
+};
+
+// Row-major grayscale image held in memory or flash
+class GrayscaleImage : public GrayscaleSource
+{
+public:
+  GrayscaleImage(const uint8_t *pixels, uint16_t width, uint16_t height)
+      : pixels(pixels), columns(width), rows(height) {}
+
+  uint16_t width() const override { return columns; }
+  uint16_t height() const override { return rows; }
+
+  const uint8_t *grayRow(uint16_t y, uint8_t *) override
+  {
+    return pixels + static_cast<size_t>(y) * columns;
+  }
+
+private:
+  const uint8_t *pixels;
+  uint16_t columns;
+  uint16_t rows;
+};
+
+// Threshold matrix for ordered dithering, built at compile time from the
+// recursive Bayer index. A gray level below the threshold prints black.
+template <size_t Order>
+constexpr std::array<uint8_t, Order * Order> makeBayerThresholds()
+{
+  static_assert(Order >= 2 && Order <= 16 && (Order & (Order - 1)) == 0, "Bayer order must be a power of two");
+
+  std::array<uint8_t, Order * Order> thresholds = {};
+  size_t levels = 0;
+
+  while ((static_cast<size_t>(1) << levels) < Order)
+  {
+    ++levels;
+  }
+
+  for (size_t y = 0; y < Order; ++y)
+  {
+    for (size_t x = 0; x < Order; ++x)
+    {
+      size_t index = 0;
+
+      for (size_t level = 0; level < levels; ++level)
+      {
+        size_t digit = (((x ^ y) >> level) & 1) * 2 + ((y >> level) & 1);
+        index |= digit << (2 * (levels - 1 - level));
+      }
+
+      thresholds[y * Order + x] = static_cast<uint8_t>(((2 * index + 1) * 256) / (2 * Order * Order));
+    }
+  }
+
+  return thresholds;
+}
+
+namespace BayerMatrices
+{
+  inline constexpr auto BAYER_4X4 = makeBayerThresholds<4>();
+  inline constexpr auto BAYER_8X8 = makeBayerThresholds<8>();
+
+  // Index rows start 0 8 2 10 / 12 4 14 6 (4x4); the 8x8 matrix ends on 21
+  static_assert(BAYER_4X4[1] == (17 * 256) / 32 && BAYER_4X4[4] == (25 * 256) / 32, "Bad 4x4 Bayer matrix");
+  static_assert(BAYER_8X8[0] == 2 && BAYER_8X8[63] == (43 * 256) / 128, "Bad 8x8 Bayer matrix");
+}
+
+enum class DitherMode
+{
+  Threshold,
+  Bayer4x4,
+  Bayer8x8,
+  FloydSteinberg
+};
+
+// Dithers a grayscale source into packed 1-bpp label rows as they are pulled,
+// placing the image at (x, y) on the label. Floyd-Steinberg keeps only two
+// rows of error terms, in 1/16 units so the diffusion weights stay integer;
+// memory is bounded by MAX_WIDTH whatever the image height. Error diffusion
+// depends on the rows above, so rows must be pulled in order; jumping back
+// replays the image from its first row. An image wider than MAX_WIDTH would
+// overrun the gray row buffer, so it is refused and renders as blank rows.
+class DitherRowSource : public RowSource
+{
+public:
+  static const uint16_t MAX_WIDTH = MAX_ROW_BYTES * 8;
+  static const uint8_t THRESHOLD = 128;
+
+  DitherRowSource(GrayscaleSource &image, DitherMode mode, uint16_t x, uint16_t y, uint16_t width, uint16_t height);
+
+  uint16_t width() const override { return columns; }
+  uint16_t height() const override { return rows; }
+  RowSpan renderRow(uint16_t y, uint8_t *scratch) override;
+
+  bool imageAccepted() const { return imageFits; }
+
+private:
+  uint16_t visibleWidth(size_t rowBytes) const;
+  void resetErrors();
+  void ditherOrdered(const uint8_t *gray, uint16_t imageRow, uint16_t count, uint8_t *row);
+  void ditherFloydSteinberg(const uint8_t *gray, uint16_t imageRow, uint16_t count, uint8_t *row);
+
+  GrayscaleSource &image;
+  DitherMode mode;
+  uint16_t left;
+  uint16_t top;
+  uint16_t columns;
+  uint16_t rows;
+  bool imageFits;
+
+  uint16_t nextImageRow;
+  uint8_t grayScratch[MAX_WIDTH];
+  // One guard cell on each side so the kernel never needs an edge check
+  int16_t errors[2][MAX_WIDTH + 2];
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <FS.h>
+
+#ifndef NIIMBOT_FRAME_CACHE_ENTRIES
+#define NIIMBOT_FRAME_CACHE_ENTRIES 16
+#endif
+
+#ifndef NIIMBOT_FRAME_CACHE_BYTES
+#define NIIMBOT_FRAME_CACHE_BYTES (256 * 1024)
+#endif
+
+// Persistent cache of fully framed row streams in LittleFS, keyed by a hash
+// of the label content and print settings (see ContentHash). A hit replays
+// the stored PRINT_LINE/PRINT_WHITESPACE frames as they are, skipping
+// rendering, encoding and checksumming; a miss records the frames while the
+// label is encoded. Entries are evicted least recently used first once the
+// entry or byte budget is exceeded. Use order is kept in RAM and only reaches
+// flash with the next store or removal, so a hit never writes to flash.
+class FrameCache
+{
+public:
+  static const size_t MAX_ENTRIES = NIIMBOT_FRAME_CACHE_ENTRIES;
+  static const uint32_t MAX_BYTES = NIIMBOT_FRAME_CACHE_BYTES;
+
+  // Mix into every key; bump whenever the encoder's output changes
+  static const uint32_t FORMAT_VERSION = 1;
+
+  FrameCache();
+
+  // Mounts the filesystem, formatting it if it can't be mounted
+  bool begin();
+
+  bool contains(uint64_t key) const;
+
+  // Replay: open the stream for `key` (counting a hit or a miss), then read
+  // it back one frame at a time until readFrame() returns false. A damaged
+  // stream is dropped from the cache and flagged by replayDamaged(), the
+  // frames read before it are still good.
+  bool open(uint64_t key);
+  bool readFrame(uint8_t *buffer, size_t capacity, size_t &length);
+  void close();
+  bool replaying() const { return reading; }
+  bool replayDamaged() const { return damaged; }
+
+  // Record: frames appended between beginRecording() and commitRecording()
+  // become the entry for `key`
+  void beginRecording(uint64_t key);
+  void record(const uint8_t *frame, size_t length);
+  bool commitRecording();
+  void abortRecording();
+  bool recording() const { return writing; }
+
+  size_t entryCount() const { return count; }
+  uint32_t totalBytes() const;
+
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t stores;
+  uint32_t evictions;
+  uint32_t corruptions;
+
+private:
+  struct Entry
+  {
+    uint64_t key;
+    uint32_t size;
+    uint32_t lastUsed;
+  };
+
+  int find(uint64_t key) const;
+  void remove(size_t index);
+  void evictLeastRecentlyUsed();
+  void loadIndex();
+  void saveIndex();
+  void removeOrphans();
+  static void pathFor(uint64_t key, char *path, size_t size);
+
+  Entry entries[MAX_ENTRIES];
+  size_t count;
+  uint32_t useClock;
+  bool mounted;
+
+  File reader;
+  bool reading;
+  bool damaged;
+  uint64_t readingKey;
+
+  File writer;
+  bool writing;
+  bool writeFailed;
+  uint64_t recordingKey;
+  uint32_t recordedBytes;
+};
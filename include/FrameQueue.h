@@ -0,0 +1,161 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+
+// Fixed-size queue of whole frames in one contiguous byte ring. Each frame is
+// stored as a 16-bit length followed by its bytes, padded to an even size. A
+// frame never wraps: when it doesn't fit before the end of the ring a wrap
+// marker sends it to the start, so front() can always hand out a contiguous
+// view for the BLE write. Push and pop are O(1) and never allocate.
+//
+// Like ByteRing it is safe for one producer (push) and one consumer
+// (front/pop) running concurrently.
+template <size_t Capacity>
+class FrameQueue
+{
+  static_assert(Capacity >= 64 && (Capacity & (Capacity - 1)) == 0, "FrameQueue capacity must be a power of two");
+
+public:
+  static const size_t RECORD_HEADER_SIZE = 2;
+
+  FrameQueue() : head(0), tail(0), pushed(0), popped(0), storage() {}
+
+  // Producer side. Whether a frame of `length` bytes would be accepted now.
+  bool fits(size_t length) const
+  {
+    size_t writeIndex = tail.load(std::memory_order_relaxed);
+    return length < WRAP_MARKER && spaceNeeded(writeIndex, length) <= Capacity - (writeIndex - head.load(std::memory_order_acquire));
+  }
+
+  // Returns false, leaving the queue unchanged, when the frame doesn't fit
+  bool push(const uint8_t *data, size_t length)
+  {
+    size_t writeIndex = tail.load(std::memory_order_relaxed);
+
+    if (length >= WRAP_MARKER || spaceNeeded(writeIndex, length) > Capacity - (writeIndex - head.load(std::memory_order_acquire)))
+    {
+      return false;
+    }
+
+    size_t offset = writeIndex & MASK;
+
+    if (offset + recordSize(length) > Capacity)
+    {
+      writeLength(offset, WRAP_MARKER);
+      writeIndex += Capacity - offset;
+      offset = 0;
+    }
+
+    writeLength(offset, length);
+    memcpy(storage + offset + RECORD_HEADER_SIZE, data, length);
+
+    tail.store(writeIndex + recordSize(length), std::memory_order_release);
+    pushed.store(pushed.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. The oldest frame, or nullptr when the queue is empty; the
+  // view stays valid until pop().
+  const uint8_t *front(size_t &length)
+  {
+    size_t writeIndex = tail.load(std::memory_order_acquire);
+    size_t readIndex = skipWrapMarker(writeIndex);
+
+    if (readIndex == writeIndex)
+    {
+      length = 0;
+      return nullptr;
+    }
+
+    size_t offset = readIndex & MASK;
+    length = readLength(offset);
+    return storage + offset + RECORD_HEADER_SIZE;
+  }
+
+  void pop()
+  {
+    size_t writeIndex = tail.load(std::memory_order_acquire);
+    size_t readIndex = skipWrapMarker(writeIndex);
+
+    if (readIndex == writeIndex)
+    {
+      return;
+    }
+
+    head.store(readIndex + recordSize(readLength(readIndex & MASK)), std::memory_order_release);
+    popped.store(popped.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // Either side
+  size_t frameCount() const
+  {
+    return pushed.load(std::memory_order_acquire) - popped.load(std::memory_order_acquire);
+  }
+
+  bool empty() const { return frameCount() == 0; }
+
+  size_t bytesUsed() const
+  {
+    return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+  }
+
+  static constexpr size_t capacity() { return Capacity; }
+
+private:
+  static const size_t MASK = Capacity - 1;
+  static const uint16_t WRAP_MARKER = 0xFFFF;
+
+  static size_t recordSize(size_t length)
+  {
+    return RECORD_HEADER_SIZE + ((length + 1) & ~static_cast<size_t>(1));
+  }
+
+  // Record plus any padding skipped to keep it contiguous. Records are even
+  // sized, so there is always room for the wrap marker before the end.
+  static size_t spaceNeeded(size_t writeIndex, size_t length)
+  {
+    size_t offset = writeIndex & MASK;
+    size_t record = recordSize(length);
+
+    return offset + record > Capacity ? Capacity - offset + record : record;
+  }
+
+  void writeLength(size_t offset, uint16_t length)
+  {
+    storage[offset] = static_cast<uint8_t>(length);
+    storage[offset + 1] = static_cast<uint8_t>(length >> 8);
+  }
+
+  uint16_t readLength(size_t offset) const
+  {
+    return storage[offset] | (storage[offset + 1] << 8);
+  }
+
+  // `writeIndex` is the consumer's one snapshot of tail for the whole
+  // operation; only bytes before it are known to be written, so a marker is
+  // only read when the snapshot says the queue isn't empty. The producer
+  // publishes a marker and the record after it together, so a skipped marker
+  // never leaves the queue empty.
+  size_t skipWrapMarker(size_t writeIndex)
+  {
+    size_t readIndex = head.load(std::memory_order_relaxed);
+
+    if (readIndex != writeIndex && readLength(readIndex & MASK) == WRAP_MARKER)
+    {
+      readIndex += Capacity - (readIndex & MASK);
+      head.store(readIndex, std::memory_order_release);
+    }
+
+    return readIndex;
+  }
+
+  std::atomic<size_t> head;
+  std::atomic<size_t> tail;
+  std::atomic<size_t> pushed;
+  std::atomic<size_t> popped;
+  uint8_t storage[Capacity];
+};
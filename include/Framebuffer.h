@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "RowSpan.h"
+
+// Packed 1-bpp label raster. Rows are padded to a 32-bit stride and stored
+// in one contiguous block, either caller-provided or a single allocation.
+class Framebuffer
+{
+public:
+  static constexpr size_t strideFor(uint16_t width) { return ((width + 31) / 32) * sizeof(uint32_t); }
+  static constexpr size_t storageSizeFor(uint16_t width, uint16_t height) { return strideFor(width) * height; }
+
+  Framebuffer(uint16_t width, uint16_t height);
+  Framebuffer(uint16_t width, uint16_t height, uint8_t *storage);
+  ~Framebuffer();
+
+  Framebuffer(const Framebuffer &) = delete;
+  Framebuffer &operator=(const Framebuffer &) = delete;
+
+  uint16_t width() const { return columns; }
+  uint16_t height() const { return rows; }
+  size_t stride() const { return rowStride; }
+  bool valid() const { return pixels != nullptr; }
+
+  // Only the bytes covering `width` pixels, not the stride padding
+  RowSpan row(uint16_t y) const
+  {
+    RowSpan span = {pixels + y * rowStride, static_cast<size_t>((columns + 7) / 8)};
+    return span;
+  }
+
+  uint8_t *rowData(uint16_t y) { return pixels + y * rowStride; }
+
+  void clear();
+  void setPixel(uint16_t x, uint16_t y, bool black);
+  bool getPixel(uint16_t x, uint16_t y) const;
+  void fillRect(uint16_t x, uint16_t y, uint16_t width, uint16_t height, bool black);
+  void setRow(uint16_t y, const uint8_t *data, size_t length);
+
+private:
+  uint16_t columns;
+  uint16_t rows;
+  size_t rowStride;
+  uint8_t *pixels;
+  bool ownsPixels;
+};
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+
+#include "PrinterProtocol.h"
+
+// Fixed-capacity command frame. The header, body, checksum and trailer are
+// written in place in a single pass, so building a frame never touches the heap.
+// Body bytes past MAX_BODY_SIZE are refused and mark the frame invalid; it is
+// still finished into a well-formed frame of what fit, but must not be sent.
+class PrinterFrame
+{
+public:
+  PrinterFrame() : length(0), checksum(0), overflowed(false) {}
+
+  PrinterFrame(uint8_t commandCode, const uint8_t *body, size_t bodyLength)
+  {
+    begin(commandCode);
+    append(body, bodyLength);
+    finish();
+  }
+
+  void begin(uint8_t commandCode)
+  {
+    bytes[0] = PrinterFraming::START_BYTE;
+    bytes[1] = PrinterFraming::START_BYTE;
+    bytes[2] = commandCode;
+    bytes[3] = 0x00; // patched with the body length in finish()
+
+    length = PrinterFraming::HEADER_SIZE;
+    checksum = commandCode;
+    overflowed = false;
+  }
+
+  // Both return false, leaving the body unchanged, when the bytes don't fit
+  bool push(uint8_t value)
+  {
+    if (remaining() == 0)
+    {
+      overflowed = true;
+      return false;
+    }
+
+    bytes[length++] = value;
+    checksum ^= value;
+    return true;
+  }
+
+  bool append(const uint8_t *data, size_t dataLength)
+  {
+    if (dataLength > remaining())
+    {
+      overflowed = true;
+      return false;
+    }
+
+    for (size_t i = 0; i < dataLength; ++i)
+    {
+      bytes[length++] = data[i];
+      checksum ^= data[i];
+    }
+
+    return true;
+  }
+
+  void finish()
+  {
+    uint8_t bodyLength = static_cast<uint8_t>(length - PrinterFraming::HEADER_SIZE);
+
+    bytes[3] = bodyLength;
+    checksum ^= bodyLength;
+
+    bytes[length++] = checksum;
+    bytes[length++] = PrinterFraming::END_BYTE;
+    bytes[length++] = PrinterFraming::END_BYTE;
+  }
+
+  size_t bodySize() const
+  {
+    return length - PrinterFraming::HEADER_SIZE;
+  }
+
+  size_t remaining() const
+  {
+    return PrinterFraming::MAX_BODY_SIZE - bodySize();
+  }
+
+  bool valid() const { return !overflowed; }
+
+  uint8_t *data() { return bytes; }
+  const uint8_t *data() const { return bytes; }
+  size_t size() const { return length; }
+
+private:
+  uint8_t bytes[PrinterFraming::MAX_FRAME_SIZE];
+  size_t length;
+  uint8_t checksum;
+  bool overflowed;
+};
+
+// Frames whose bytes never change are encoded at compile time and kept in
+// flash, so sending one is just a pointer and a length.
+template <size_t BodyLength>
+constexpr std::array<uint8_t, BodyLength + PrinterFraming::OVERHEAD> makeFixedFrame(uint8_t commandCode, const uint8_t (&body)[BodyLength])
+{
+  static_assert(BodyLength <= PrinterFraming::MAX_BODY_SIZE, "Frame body too long");
+
+  std::array<uint8_t, BodyLength + PrinterFraming::OVERHEAD> frame = {};
+  uint8_t checksum = commandCode ^ static_cast<uint8_t>(BodyLength);
+
+  frame[0] = PrinterFraming::START_BYTE;
+  frame[1] = PrinterFraming::START_BYTE;
+  frame[2] = commandCode;
+  frame[3] = static_cast<uint8_t>(BodyLength);
+
+  for (size_t i = 0; i < BodyLength; ++i)
+  {
+    frame[PrinterFraming::HEADER_SIZE + i] = body[i];
+    checksum ^= body[i];
+  }
+
+  frame[PrinterFraming::HEADER_SIZE + BodyLength] = checksum;
+  frame[PrinterFraming::HEADER_SIZE + BodyLength + 1] = PrinterFraming::END_BYTE;
+  frame[PrinterFraming::HEADER_SIZE + BodyLength + 2] = PrinterFraming::END_BYTE;
+
+  return frame;
+}
+
+template <size_t FrameLength>
+constexpr bool isValidFrame(const std::array<uint8_t, FrameLength> &frame)
+{
+  if (FrameLength < PrinterFraming::OVERHEAD || frame[3] != FrameLength - PrinterFraming::OVERHEAD)
+  {
+    return false;
+  }
+
+  uint8_t checksum = 0;
+  for (size_t i = 2; i < FrameLength - 3; ++i)
+  {
+    checksum ^= frame[i];
+  }
+
+  return frame[0] == PrinterFraming::START_BYTE && frame[1] == PrinterFraming::START_BYTE &&
+         frame[FrameLength - 3] == checksum &&
+         frame[FrameLength - 2] == PrinterFraming::END_BYTE && frame[FrameLength - 1] == PrinterFraming::END_BYTE;
+}
+
+namespace PrinterFrames
+{
+  inline constexpr auto CALIBRATE_LABEL_GAP = makeFixedFrame(PrinterCommands::CALIBRATE_LABEL_GAP, {0x01});
+  inline constexpr auto HEARTBEAT = makeFixedFrame(PrinterCommands::HEARTBEAT, {0x04});
+  inline constexpr auto GET_PRINT_STATUS = makeFixedFrame(PrinterCommands::GET_PRINT_STATUS, {0x01});
+  inline constexpr auto GET_LABEL_RFID = makeFixedFrame(PrinterCommands::GET_LABEL_RFID, {0x01});
+  inline constexpr auto SET_LABEL_TYPE = makeFixedFrame(PrinterCommands::SET_LABEL_TYPE, {0x01});
+  inline constexpr auto END_LABEL_PRINT_DATA_EXCHANGE = makeFixedFrame(PrinterCommands::END_LABEL_PRINT_DATA_EXCHANGE, {0x01});
+  inline constexpr auto END_PRINT = makeFixedFrame(PrinterCommands::END_PRINT, {0x01});
+
+  static_assert(isValidFrame(CALIBRATE_LABEL_GAP), "Bad CALIBRATE_LABEL_GAP frame");
+  static_assert(isValidFrame(HEARTBEAT), "Bad HEARTBEAT frame");
+  static_assert(isValidFrame(GET_PRINT_STATUS), "Bad GET_PRINT_STATUS frame");
+  static_assert(isValidFrame(GET_LABEL_RFID), "Bad GET_LABEL_RFID frame");
+  static_assert(isValidFrame(SET_LABEL_TYPE), "Bad SET_LABEL_TYPE frame");
+  static_assert(isValidFrame(END_LABEL_PRINT_DATA_EXCHANGE), "Bad END_LABEL_PRINT_DATA_EXCHANGE frame");
+  static_assert(isValidFrame(END_PRINT), "Bad END_PRINT frame");
+
+  // Known-good capture: 55 55 DC 01 04 D9 AA AA
+  static_assert(HEARTBEAT.size() == 8 && HEARTBEAT[5] == 0xD9, "HEARTBEAT checksum mismatch");
+}
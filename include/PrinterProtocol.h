@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace PrinterCommands
+{
+  const uint8_t CALIBRATE_LABEL_GAP = 0x8E;
+  const uint8_t HEARTBEAT = 0xDC;
+  const uint8_t GET_PRINT_STATUS = 0xA3;
+  const uint8_t GET_LABEL_RFID = 0x1A;
+  const uint8_t SET_LABEL_TYPE = 0x23;
+  const uint8_t SET_PRINT_DENSITY = 0x21;
+  const uint8_t START_LABEL_PRINT_DATA_EXCHANGE = 0x01;
+  const uint8_t SET_PRINT_DIMENSIONS = 0x13;
+  const uint8_t END_LABEL_PRINT_DATA_EXCHANGE = 0xE3;
+  const uint8_t END_PRINT = 0xF3;
+  const uint8_t PRINT_LINE = 0x85;
+  const uint8_t PRINT_LINE_INDEXED = 0x83;
+  const uint8_t PRINT_WHITESPACE = 0x84;
+}
+
+namespace PrinterResponses
+{
+  const uint8_t NOT_SUPPORTED = 0x00;
+  const uint8_t PRINT_ERROR = 0xDB;
+  const uint8_t CALIBRATE_LABEL_GAP = 0x8F;
+  const uint8_t HEARTBEAT = 0xD9; // reply to a type 0x04 heartbeat
+  const uint8_t PRINT_STATUS = 0xB3;
+  const uint8_t LABEL_RFID = 0x1B;
+  const uint8_t SET_LABEL_TYPE = 0x33;
+  const uint8_t SET_PRINT_DENSITY = 0x31;
+  const uint8_t START_LABEL_PRINT_DATA_EXCHANGE = 0x02;
+  const uint8_t SET_PRINT_DIMENSIONS = 0x14;
+  const uint8_t END_LABEL_PRINT_DATA_EXCHANGE = 0xE4;
+  const uint8_t END_PRINT = 0xF4;
+
+  // Unsolicited while printing, carries the row the printer has reached
+  const uint8_t PRINTER_CHECK_LINE = 0xD3;
+}
+
+inline uint8_t expectedResponseCode(uint8_t commandCode)
+{
+  switch (commandCode)
+  {
+  case PrinterCommands::CALIBRATE_LABEL_GAP:
+    return PrinterResponses::CALIBRATE_LABEL_GAP;
+  case PrinterCommands::HEARTBEAT:
+    return PrinterResponses::HEARTBEAT;
+  case PrinterCommands::GET_PRINT_STATUS:
+    return PrinterResponses::PRINT_STATUS;
+  case PrinterCommands::GET_LABEL_RFID:
+    return PrinterResponses::LABEL_RFID;
+  case PrinterCommands::SET_LABEL_TYPE:
+    return PrinterResponses::SET_LABEL_TYPE;
+  case PrinterCommands::SET_PRINT_DENSITY:
+    return PrinterResponses::SET_PRINT_DENSITY;
+  case PrinterCommands::START_LABEL_PRINT_DATA_EXCHANGE:
+    return PrinterResponses::START_LABEL_PRINT_DATA_EXCHANGE;
+  case PrinterCommands::SET_PRINT_DIMENSIONS:
+    return PrinterResponses::SET_PRINT_DIMENSIONS;
+  case PrinterCommands::END_LABEL_PRINT_DATA_EXCHANGE:
+    return PrinterResponses::END_LABEL_PRINT_DATA_EXCHANGE;
+  case PrinterCommands::END_PRINT:
+    return PrinterResponses::END_PRINT;
+  default:
+    return commandCode + 1;
+  }
+}
+
+inline bool isResponseTo(uint8_t commandCode, uint8_t responseCode)
+{
+  // Depending on firmware and heartbeat type the printer answers with any of
+  // the heartbeat reply variants
+  if (commandCode == PrinterCommands::HEARTBEAT)
+  {
+    return responseCode == 0xD9 || responseCode == 0xDD || responseCode == 0xDE || responseCode == 0xDF;
+  }
+
+  return responseCode == expectedResponseCode(commandCode);
+}
+
+// Reply to GET_PRINT_STATUS: pages printed so far in the current job, then
+// the print and feed progress of the page in hand, in percent
+struct PrintStatus
+{
+  uint16_t page;
+  uint8_t printProgress;
+  uint8_t feedProgress;
+};
+
+inline bool decodePrintStatus(const uint8_t *payload, size_t length, PrintStatus &status)
+{
+  if (length < 4)
+  {
+    return false;
+  }
+
+  status.page = (payload[0] << 8) | payload[1];
+  status.printProgress = payload[2];
+  status.feedProgress = payload[3];
+  return true;
+}
+
+namespace PrinterFraming
+{
+  const uint8_t START_BYTE = 0x55;
+  const uint8_t END_BYTE = 0xAA;
+
+  // 0x55 0x55, code, length, ..., checksum, 0xAA 0xAA
+  const size_t HEADER_SIZE = 4;
+  const size_t OVERHEAD = 7;
+  const size_t MAX_BODY_SIZE = 255;
+  const size_t MAX_FRAME_SIZE = MAX_BODY_SIZE + OVERHEAD;
+}
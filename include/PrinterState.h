@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// One cached reading and when it was taken
+template <typename T>
+struct StateField
+{
+  T value;
+  uint32_t updatedAt;
+  bool known;
+
+  void set(T newValue, uint32_t now)
+  {
+    value = newValue;
+    updatedAt = now;
+    known = true;
+  }
+
+  bool freshAt(uint32_t now, uint32_t maxAgeMs) const
+  {
+    return known && now - updatedAt <= maxAgeMs;
+  }
+};
+
+// Latest printer condition, decoded from heartbeat replies and error
+// notifications as they arrive, so nothing has to ask the printer again to
+// know whether it can print.
+struct PrinterState
+{
+  StateField<bool> lidClosed;
+  StateField<bool> paperPresent;
+  StateField<uint8_t> batteryLevel; // 1 to 4 bars
+  StateField<uint8_t> rfidReadState;
+  StateField<uint8_t> errorCode; // from the last PRINT_ERROR, 0 once cleared
+
+  // Heartbeat replies differ by firmware and heartbeat type; the variant is
+  // told apart by payload length, as niimprint does. Returns false for an
+  // unknown layout.
+  bool applyHeartbeat(const uint8_t *payload, size_t length, uint32_t now);
+
+  void applyError(uint8_t code, uint32_t now) { errorCode.set(code, now); }
+  void clearError(uint32_t now) { errorCode.set(0, now); }
+
+  // Why a job can't start, judged only from readings younger than
+  // `maxAgeMs`, or nullptr when nothing fresh speaks against it
+  const char *printBlocker(uint32_t now, uint32_t maxAgeMs) const;
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "RowSource.h"
+
+// QR code encoder for byte-mode payloads, versions 1 to 10. Picks the
+// smallest version that fits and the mask with the lowest penalty score.
+class QrCode
+{
+public:
+  enum class Ecc : uint8_t
+  {
+    Low,
+    Medium,
+    Quartile,
+    High
+  };
+
+  static const uint8_t MAX_VERSION = 10;
+  static const uint8_t MAX_SIZE = MAX_VERSION * 4 + 17;
+  static const uint8_t QUIET_ZONE_MODULES = 4;
+
+  QrCode() : version(0), size(0) {}
+
+  // Returns false if the payload does not fit in a version 10 symbol
+  bool encode(const uint8_t *data, size_t length, Ecc ecc);
+  bool encode(const char *text, Ecc ecc);
+
+  uint8_t symbolSize() const { return size; }
+
+  // Symbol plus the quiet zone on both sides
+  uint8_t moduleCount() const { return size + QUIET_ZONE_MODULES * 2; }
+  uint8_t symbolVersion() const { return version; }
+
+  bool module(uint8_t x, uint8_t y) const { return getBit(modules, y * size + x); }
+
+  // ORs module row `moduleY` into `row`, `scale` pixels per module from `x`
+  void renderRow(uint8_t moduleY, uint16_t x, uint8_t scale, uint8_t *row, size_t rowBytes) const;
+
+private:
+  static const size_t BITMAP_BYTES = (MAX_SIZE * MAX_SIZE + 7) / 8;
+
+  static bool getBit(const uint8_t *bits, size_t index) { return bits[index >> 3] & (0x80 >> (index & 7)); }
+
+  void setModule(uint8_t x, uint8_t y, bool dark);
+  void setFunctionModule(uint8_t x, uint8_t y, bool dark);
+  bool isFunction(uint8_t x, uint8_t y) const { return getBit(functionModules, y * size + x); }
+
+  void drawFunctionPatterns(Ecc ecc);
+  void drawFinderPattern(int x, int y);
+  void drawAlignmentPattern(int x, int y);
+  void drawFormatBits(Ecc ecc, uint8_t mask);
+  void drawVersion();
+  void drawCodewords(const uint8_t *codewords, size_t count);
+  void applyMask(uint8_t mask);
+  uint32_t penaltyScore() const;
+
+  uint8_t version;
+  uint8_t size;
+  uint8_t modules[BITMAP_BYTES];
+  uint8_t functionModules[BITMAP_BYTES];
+};
+
+// Expands each module row to `scale` output rows; rows inside one module
+// row are identical, so the encoder merges them into a single frame. (x, y)
+// is the outer corner of the quiet zone, the symbol starts QUIET_ZONE_MODULES
+// modules in on both axes and the whole code spans moduleCount() * scale.
+class QrRowSource : public RowSource
+{
+public:
+  QrRowSource(const QrCode &qr, uint16_t x, uint16_t y, uint8_t scale, uint16_t width, uint16_t height)
+      : qr(qr), left(x), top(y), scale(scale), columns(width), rows(height) {}
+
+  uint16_t width() const override { return columns; }
+  uint16_t height() const override { return rows; }
+  RowSpan renderRow(uint16_t y, uint8_t *scratch) override;
+
+private:
+  const QrCode &qr;
+  uint16_t left;
+  uint16_t top;
+  uint8_t scale;
+  uint16_t columns;
+  uint16_t rows;
+};
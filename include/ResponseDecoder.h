@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ByteRing.h"
+#include "PrinterProtocol.h"
+
+struct PrinterResponse
+{
+  uint8_t code;
+  const uint8_t *payload; // only valid for the duration of the handler call
+  uint8_t length;
+};
+
+typedef void (*PrinterResponseHandler)(const PrinterResponse &response);
+
+// Incremental decoder for 0x55 0x55 ... 0xAA 0xAA frames coming back from the
+// printer. Notifications are appended to a ring from the BLE callback and
+// decoded later from loop(); frames may be split across notifications or
+// packed several to a notification. Payloads are handed out in place.
+// A frame still waiting for bytes is given up as soon as a complete, valid
+// frame shows up behind it, so a corrupted length byte can't stall decoding.
+class ResponseDecoder
+{
+public:
+  static const size_t BUFFER_SIZE = 1024;
+
+  ResponseDecoder() : framesDecoded(0), corruptFrames(0), bytesDiscarded(0), bytesOverflowed(0) {}
+
+  // Called from the BLE notification callback
+  void receive(const uint8_t *data, size_t length);
+
+  // Called from loop(); returns how many frames were handed to the handler
+  size_t process(PrinterResponseHandler handler);
+
+  uint32_t framesDecoded;
+  uint32_t corruptFrames;
+  uint32_t bytesDiscarded;
+  uint32_t bytesOverflowed;
+
+private:
+  enum class FrameCheck
+  {
+    Incomplete,
+    Corrupt,
+    Valid
+  };
+
+  FrameCheck checkFrame(size_t offset, size_t available) const;
+  size_t findValidFrame(size_t from, size_t available) const;
+
+  ByteRing<BUFFER_SIZE> buffer;
+  uint8_t wrappedPayload[PrinterFraming::MAX_BODY_SIZE];
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "RowSource.h"
+
+#ifndef NIIMBOT_ROTATION_BAND_ROWS
+#define NIIMBOT_ROTATION_BAND_ROWS 32
+#endif
+
+// Transposes an 8x8 bit tile in three swap stages (Hacker's Delight 7-3).
+// Row 0 is the most significant byte, column 0 the most significant bit.
+inline uint64_t transposeBits8x8(uint64_t tile)
+{
+  uint64_t t;
+
+  t = (tile ^ (tile >> 7)) & 0x00AA00AA00AA00AAULL;
+  tile ^= t ^ (t << 7);
+  t = (tile ^ (tile >> 14)) & 0x0000CCCC0000CCCCULL;
+  tile ^= t ^ (t << 14);
+  t = (tile ^ (tile >> 28)) & 0x00000000F0F0F0F0ULL;
+  tile ^= t ^ (t << 28);
+
+  return tile;
+}
+
+inline uint8_t reverseBits8(uint8_t value)
+{
+  value = (value >> 4) | (value << 4);
+  value = ((value & 0xCC) >> 2) | ((value & 0x33) << 2);
+  value = ((value & 0xAA) >> 1) | ((value & 0x55) << 1);
+  return value;
+}
+
+// Clockwise
+enum class Rotation
+{
+  None,
+  Quarter,
+  Half,
+  ThreeQuarters
+};
+
+// Rotates another row source while rows are pulled in print order. Quarter
+// turns are built a band of BAND_ROWS output rows at a time: every source
+// row is pulled once per band, eight at a time, and cut into 8x8 tiles that
+// are transposed as whole 64-bit words. Only the band and eight source rows
+// are resident. A half turn reverses one source row per output row.
+//
+// Source rows are pulled repeatedly and bottom-up for a half turn, so
+// sources whose rows depend on earlier ones (error diffusion) should be
+// rendered into a Framebuffer first.
+class RotatedRowSource : public RowSource
+{
+public:
+  static const uint16_t BAND_ROWS = NIIMBOT_ROTATION_BAND_ROWS;
+  static const uint16_t MAX_WIDTH = MAX_ROW_BYTES * 8;
+
+  static_assert(BAND_ROWS % 8 == 0, "Rotation band must be whole tiles");
+
+  RotatedRowSource(RowSource &source, Rotation rotation);
+
+  uint16_t width() const override;
+  uint16_t height() const override;
+  RowSpan renderRow(uint16_t y, uint8_t *scratch) override;
+
+  uint32_t bandsBuilt;
+
+private:
+  bool quarterTurn() const { return rotation == Rotation::Quarter || rotation == Rotation::ThreeQuarters; }
+  size_t outputRowBytes() const;
+  void buildBand(uint16_t firstRow);
+  void renderHalfTurn(uint16_t y, uint8_t *row, size_t rowBytes);
+
+  RowSource &source;
+  Rotation rotation;
+
+  int32_t bandStart;
+  uint8_t band[BAND_ROWS][MAX_ROW_BYTES];
+  uint8_t sourceScratch[8][MAX_ROW_BYTES];
+};
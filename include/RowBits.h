@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Sets `count` pixels starting at `x` in a packed MSB-first row, filling
+// whole bytes at once and clipping to `rowBytes`
+inline void fillRowBits(uint8_t *row, size_t rowBytes, uint32_t x, uint32_t count)
+{
+  uint32_t end = x + count;
+  uint32_t limit = rowBytes * 8;
+
+  if (end > limit)
+  {
+    end = limit;
+  }
+
+  while (x < end && (x & 7) != 0)
+  {
+    row[x / 8] |= 0x80 >> (x & 7);
+    ++x;
+  }
+
+  if (x < end)
+  {
+    size_t wholeBytes = (end - x) / 8;
+    memset(row + x / 8, 0xFF, wholeBytes);
+    x += wholeBytes * 8;
+  }
+
+  while (x < end)
+  {
+    row[x / 8] |= 0x80 >> (x & 7);
+    ++x;
+  }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "PrinterFrame.h"
+#include "RowSpan.h"
+
+typedef void (*FrameSink)(const PrinterFrame &frame, void *context);
+
+// Turns raster rows, fed in print order, into row command frames. Runs of
+// identical rows are merged into a single frame using the repeat field, and
+// runs of blank rows into the fewest PRINT_WHITESPACE frames. Inked rows go
+// out as a full bitmap (PRINT_LINE) or as a list of set pixel positions
+// (PRINT_LINE_INDEXED), whichever encodes smaller.
+class RowEncoder
+{
+public:
+  static const size_t MAX_ROW_BYTES = 64;
+  static const uint8_t MAX_REPEAT = 255;
+
+  // The 384-dot head is driven in three segments; PRINT_LINE carries the
+  // number of black pixels each of them has to fire.
+  static const size_t PRINT_HEAD_BYTES = 48;
+  static const size_t SEGMENT_COUNT = 3;
+  static const size_t SEGMENT_BYTES = PRINT_HEAD_BYTES / SEGMENT_COUNT;
+
+  // Row number, pixel counts and repeat count ahead of the row data
+  static const size_t ROW_HEADER_SIZE = 6;
+
+  RowEncoder(FrameSink sink, void *context) : sink(sink), context(context)
+  {
+    begin(0);
+  }
+
+  void begin(uint16_t firstRow);
+  void addRow(const uint8_t *row, size_t length);
+  void addRow(RowSpan row) { addRow(row.data, row.length); }
+  void addBlankRows(uint16_t count);
+  void finish();
+
+  uint16_t nextRow() const { return pendingStart + pendingRepeat; }
+
+  // Fills the three PRINT_LINE pixel count bytes and returns the total
+  static uint16_t countBlackPixels(const uint8_t *row, size_t length, uint8_t (&pixelCounts)[SEGMENT_COUNT]);
+
+  uint32_t rowsEncoded;
+  uint32_t blankRows;
+  uint32_t framesEmitted;
+  uint32_t bitmapFrames;
+  uint32_t indexedFrames;
+  uint32_t whitespaceFrames;
+
+  // Compared to sending every run as a plain PRINT_LINE bitmap
+  uint32_t bytesSaved;
+
+private:
+  void flush();
+  void extendRun(uint16_t blackPixels, const uint8_t *row, size_t length, const uint8_t (&pixelCounts)[SEGMENT_COUNT]);
+  void appendPixelIndexes(PrinterFrame &command) const;
+
+  FrameSink sink;
+  void *context;
+
+  uint8_t pendingRow[MAX_ROW_BYTES];
+  uint8_t pendingPixelCounts[SEGMENT_COUNT];
+  size_t pendingLength;
+  uint16_t pendingBlackPixels;
+  uint16_t pendingStart;
+  uint8_t pendingRepeat;
+  bool pendingBlank;
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef NIIMBOT_ROW_WINDOW
+#define NIIMBOT_ROW_WINDOW 16
+#endif
+
+// Credit window for row frames written without response. Every frame sent
+// takes a credit until the printer reports (PRINTER_CHECK_LINE) that it got
+// past the frame's last row. If the window is exhausted and the printer goes
+// quiet, the next frame is sent as an acknowledged write instead, which
+// drains the link and restores the full window.
+class RowFlowControl
+{
+public:
+  static const size_t WINDOW = NIIMBOT_ROW_WINDOW;
+  static const uint32_t STALL_TIMEOUT_MS = 250;
+
+  RowFlowControl() : first(0), count(0), lastProgressAt(0) {}
+
+  void reset(uint32_t now);
+
+  bool hasCredit() const { return count < WINDOW; }
+  bool stalled(uint32_t now) const;
+
+  void onSent(uint16_t lastRow);
+  void onSynchronized(uint32_t now);
+  void onPrinterProgress(uint16_t row, uint32_t now);
+
+  size_t outstanding() const { return count; }
+
+  // Last printed row covered by a PRINT_LINE or PRINT_WHITESPACE frame
+  static uint16_t frameLastRow(const uint8_t *frame);
+
+private:
+  uint16_t outstandingRows[WINDOW];
+  size_t first;
+  size_t count;
+  uint32_t lastProgressAt;
+};
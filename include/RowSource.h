@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Framebuffer.h"
+#include "RowSpan.h"
+
+// Produces label rows on demand, in print order. Sources that render on the
+// fly draw into `scratch` (at least MAX_ROW_BYTES, cleared by the caller);
+// sources backed by memory may return a view of their own storage instead.
+class RowSource
+{
+public:
+  static const size_t MAX_ROW_BYTES = 64;
+
+  virtual ~RowSource() {}
+
+  virtual uint16_t width() const = 0;
+  virtual uint16_t height() const = 0;
+  virtual RowSpan renderRow(uint16_t y, uint8_t *scratch) = 0;
+};
+
+class FramebufferRowSource : public RowSource
+{
+public:
+  explicit FramebufferRowSource(const Framebuffer &framebuffer) : framebuffer(framebuffer) {}
+
+  uint16_t width() const override { return framebuffer.width(); }
+  uint16_t height() const override { return framebuffer.height(); }
+
+  RowSpan renderRow(uint16_t y, uint8_t *) override
+  {
+    return framebuffer.row(y);
+  }
+
+private:
+  const Framebuffer &framebuffer;
+};
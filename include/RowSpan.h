@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Non-owning view of one packed 1-bpp raster row, most significant bit first
+struct RowSpan
+{
+  const uint8_t *data;
+  size_t length;
+};
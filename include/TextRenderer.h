@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "BitmapFont.h"
+#include "RowSource.h"
+
+#ifndef NIIMBOT_GLYPH_CACHE_SIZE
+#define NIIMBOT_GLYPH_CACHE_SIZE 32
+#endif
+
+// Renders text one scanline at a time straight into a packed row, so a text
+// label never needs a framebuffer. Glyphs are decoded from the flash font
+// into row-major, pre-scaled 32-bit masks and kept in a small LRU cache.
+class TextRenderer
+{
+public:
+  static const size_t GLYPH_CACHE_SIZE = NIIMBOT_GLYPH_CACHE_SIZE;
+  // Taller fonts are cut off at the bottom
+  static const uint8_t MAX_GLYPH_HEIGHT = 16;
+
+  explicit TextRenderer(const BitmapFont &font);
+
+  // Largest scale whose glyph cell still fits in one 32-bit mask
+  uint8_t maxScale() const { return 32 / (font.width + 1); }
+
+  uint16_t textWidth(const char *text, uint8_t scale) const;
+  uint16_t textHeight(uint8_t scale) const { return glyphHeight * clampScale(scale); }
+
+  // ORs scanline `line` (0 at the top of the text, in output pixels) of
+  // `text` into `row`, with the text starting at pixel `x`
+  void renderScanline(const char *text, uint16_t x, uint16_t line, uint8_t scale, uint8_t *row, size_t rowBytes);
+
+  uint32_t cacheHits;
+  uint32_t cacheMisses;
+
+private:
+  struct CachedGlyph
+  {
+    char character;
+    uint8_t scale;
+    uint32_t lastUsed;
+    uint32_t rows[MAX_GLYPH_HEIGHT];
+  };
+
+  uint8_t clampScale(uint8_t scale) const;
+  const CachedGlyph &glyph(char character, uint8_t scale);
+  void decode(CachedGlyph &entry, char character, uint8_t scale) const;
+
+  const BitmapFont &font;
+  uint8_t glyphHeight;
+  CachedGlyph cache[GLYPH_CACHE_SIZE];
+  uint32_t useClock;
+};
+
+struct TextLine
+{
+  const char *text;
+  uint16_t x;
+  uint16_t y;
+  uint8_t scale;
+};
+
+class TextRowSource : public RowSource
+{
+public:
+  TextRowSource(TextRenderer &renderer, const TextLine *lines, size_t lineCount, uint16_t width, uint16_t height)
+      : renderer(renderer), lines(lines), lineCount(lineCount), columns(width), rows(height) {}
+
+  uint16_t width() const override { return columns; }
+  uint16_t height() const override { return rows; }
+  RowSpan renderRow(uint16_t y, uint8_t *scratch) override;
+
+private:
+  TextRenderer &renderer;
+  const TextLine *lines;
+  size_t lineCount;
+  uint16_t columns;
+  uint16_t rows;
+};
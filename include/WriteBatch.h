@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Packs complete frames back to back so several of them travel in a single
+// GATT write. The capacity follows the negotiated ATT MTU.
+class WriteBatch
+{
+public:
+  // Largest attribute value a single write may carry
+  static const size_t MAX_CAPACITY = 512;
+
+  static const uint16_t DEFAULT_ATT_MTU = 23;
+  static const size_t ATT_WRITE_HEADER = 3;
+
+  WriteBatch() : capacity(20), length(0), frames(0) {}
+
+  void setCapacity(size_t newCapacity)
+  {
+    capacity = newCapacity < MAX_CAPACITY ? newCapacity : MAX_CAPACITY;
+  }
+
+  // An MTU below the ATT default (0 before the exchange has completed) means
+  // the default is still in force
+  void setMtu(uint16_t mtu)
+  {
+    setCapacity((mtu < DEFAULT_ATT_MTU ? DEFAULT_ATT_MTU : mtu) - ATT_WRITE_HEADER);
+  }
+
+  bool fits(size_t frameLength) const
+  {
+    return length + frameLength <= capacity;
+  }
+
+  bool append(const uint8_t *frame, size_t frameLength)
+  {
+    if (!fits(frameLength))
+    {
+      return false;
+    }
+
+    memcpy(bytes + length, frame, frameLength);
+    length += frameLength;
+    ++frames;
+    return true;
+  }
+
+  void clear()
+  {
+    length = 0;
+    frames = 0;
+  }
+
+  const uint8_t *data() const { return bytes; }
+  size_t size() const { return length; }
+  size_t frameCount() const { return frames; }
+  bool empty() const { return length == 0; }
+
+private:
+  uint8_t bytes[MAX_CAPACITY];
+  size_t capacity;
+  size_t length;
+  size_t frames;
+};
@@ -0,0 +1,450 @@
+#ifdef NIIMBOT_BENCHMARK
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <queue>
+#include <vector>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+
+#include "Benchmark.h"
+#include "Code128.h"
+#include "Dither.h"
+#include "FrameQueue.h"
+#include "Framebuffer.h"
+#include "PrinterFrame.h"
+#include "QrCode.h"
+#include "RowEncoder.h"
+#include "Rotation.h"
+#include "TextRenderer.h"
+
+static volatile size_t heapAllocations = 0;
+static volatile size_t heapBytesRequested = 0;
+static volatile uint8_t benchmarkSink = 0;
+
+// Every operator new in the benchmark build goes through here, so a benchmark
+// can report exactly how many heap allocations its body performed.
+void *operator new(size_t size)
+{
+  ++heapAllocations;
+  heapBytesRequested += size;
+
+  void *block = malloc(size);
+
+  if (block == nullptr)
+  {
+    abort();
+  }
+
+  return block;
+}
+
+void operator delete(void *block) noexcept
+{
+  free(block);
+}
+
+void operator delete(void *block, size_t) noexcept
+{
+  free(block);
+}
+
+// The same benchmarks run on the device, reporting over Serial, and on the
+// host (see test/test_benchmarks), reporting on stdout
+static unsigned long benchmarkMicros()
+{
+#ifdef ARDUINO
+  return micros();
+#else
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static void report(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+static void report(const char *format, ...)
+{
+  char line[160];
+  va_list arguments;
+
+  va_start(arguments, format);
+  vsnprintf(line, sizeof(line), format, arguments);
+  va_end(arguments);
+
+#ifdef ARDUINO
+  Serial.print(line);
+#else
+  fputs(line, stdout);
+#endif
+}
+
+// Heap held right now on the device; the host can only tell how much the
+// benchmark build has asked for
+static size_t heapInUse()
+{
+#ifdef ARDUINO
+  return ESP.getHeapSize() - ESP.getFreeHeap();
+#else
+  return heapBytesRequested;
+#endif
+}
+
+template <typename Body>
+static unsigned long runBenchmark(const char *name, size_t iterations, Body body)
+{
+  size_t allocationsBefore = heapAllocations;
+  unsigned long start = benchmarkMicros();
+
+  for (size_t i = 0; i < iterations; ++i)
+  {
+    body(i);
+  }
+
+  unsigned long elapsed = benchmarkMicros() - start;
+  size_t allocations = heapAllocations - allocationsBefore;
+
+  report("%-36s %8lu us  %8.2f us/iter  %6.2f allocs/iter\n",
+         name,
+         elapsed,
+         static_cast<double>(elapsed) / iterations,
+         static_cast<double>(allocations) / iterations);
+
+  return elapsed;
+}
+
+// Reference copy of the vector-based framing the client used before PrinterFrame
+static std::vector<uint8_t> legacyCreateCommand(uint8_t commandCode, const std::vector<uint8_t> &bodySeq)
+{
+  std::vector<uint8_t> commandCodeSeq = {commandCode};
+  std::vector<uint8_t> dataSizeSeq = {static_cast<uint8_t>(bodySeq.size())};
+  std::vector<uint8_t> body = {};
+
+  body.insert(body.end(), commandCodeSeq.begin(), commandCodeSeq.end());
+  body.insert(body.end(), dataSizeSeq.begin(), dataSizeSeq.end());
+  body.insert(body.end(), bodySeq.begin(), bodySeq.end());
+
+  uint8_t xorValue = body[0];
+  for (size_t i = 1; i < body.size(); ++i)
+  {
+    xorValue ^= body[i];
+  }
+
+  std::vector<uint8_t> startSeq = {0x55, 0x55};
+  std::vector<uint8_t> checksumSeq = {xorValue};
+  std::vector<uint8_t> endSeq = {0xAA, 0xAA};
+  std::vector<uint8_t> command = {};
+
+  command.insert(command.end(), startSeq.begin(), startSeq.end());
+  command.insert(command.end(), body.begin(), body.end());
+  command.insert(command.end(), checksumSeq.begin(), checksumSeq.end());
+  command.insert(command.end(), endSeq.begin(), endSeq.end());
+
+  return command;
+}
+
+static void benchmarkFrameBuilder()
+{
+  const size_t iterations = 2000;
+
+  uint8_t row[54] = {0x00, 0x20, 0x80, 0x32, 0x00, 0x01};
+  for (size_t i = 6; i < sizeof(row); ++i)
+  {
+    row[i] = static_cast<uint8_t>(i * 37);
+  }
+
+  std::vector<uint8_t> rowSeq(row, row + sizeof(row));
+
+  runBenchmark("frame/legacy vector createCommand", iterations, [&](size_t i)
+               {
+                 std::vector<uint8_t> command = legacyCreateCommand(0x85, rowSeq);
+                 benchmarkSink ^= command[i % command.size()]; });
+
+  runBenchmark("frame/PrinterFrame", iterations, [&](size_t i)
+               {
+                 PrinterFrame command(0x85, row, sizeof(row));
+                 benchmarkSink ^= command.data()[i % command.size()]; });
+}
+
+static void discardFrame(const PrinterFrame &frame, void *)
+{
+  benchmarkSink ^= frame.data()[frame.size() - 3];
+}
+
+void benchmarkRowEncoder()
+{
+  const size_t iterations = 2000;
+  const size_t rowCount = 16;
+
+  static uint8_t rows[rowCount][RowEncoder::PRINT_HEAD_BYTES];
+  uint32_t seed = 0x1234567;
+
+  for (size_t row = 0; row < rowCount; ++row)
+  {
+    for (size_t i = 0; i < RowEncoder::PRINT_HEAD_BYTES; ++i)
+    {
+      seed = seed * 1103515245 + 12345;
+      rows[row][i] = static_cast<uint8_t>(seed >> 16);
+    }
+  }
+
+  runBenchmark("row/countBlackPixels", iterations, [&](size_t i)
+               {
+                 uint8_t pixelCounts[RowEncoder::SEGMENT_COUNT];
+                 benchmarkSink ^= RowEncoder::countBlackPixels(rows[i % rowCount], RowEncoder::PRINT_HEAD_BYTES, pixelCounts); });
+
+  RowEncoder encoder(discardFrame, nullptr);
+  encoder.begin(0);
+
+  runBenchmark("row/RowEncoder::addRow", iterations, [&](size_t i)
+               { encoder.addRow(rows[i % rowCount], RowEncoder::PRINT_HEAD_BYTES); });
+
+  encoder.finish();
+}
+
+void benchmarkTextRenderer()
+{
+  const size_t iterations = 200;
+  const char *text = "NIIMBOT B1 0123456789";
+  const uint8_t scale = 2;
+
+  static TextRenderer renderer(Fonts::FONT_5X7);
+  uint8_t row[RowEncoder::PRINT_HEAD_BYTES];
+  uint16_t lines = renderer.textHeight(scale);
+
+  unsigned long elapsed = runBenchmark("text/renderScanline x2 (full line)", iterations, [&](size_t i)
+                                       {
+                                         for (uint16_t line = 0; line < lines; ++line)
+                                         {
+                                           memset(row, 0, sizeof(row));
+                                           renderer.renderScanline(text, 4, line, scale, row, sizeof(row));
+                                           benchmarkSink ^= row[i % sizeof(row)];
+                                         } });
+
+  report("text: %.0f characters/s, glyph cache %u hits / %u misses\n",
+         elapsed > 0 ? iterations * strlen(text) * 1e6 / elapsed : 0.0,
+         renderer.cacheHits,
+         renderer.cacheMisses);
+}
+
+void benchmarkBarcodes()
+{
+  const size_t iterations = 50;
+  uint8_t scratch[RowSource::MAX_ROW_BYTES];
+
+  runBenchmark("barcode/Code128 encode+render 96 rows", iterations, [&](size_t i)
+               {
+                 Code128 barcode;
+                 barcode.encode("SHIP-2024-0001234567");
+
+                 Code128RowSource source(barcode, 8, 0, 2, 96, 384, 96);
+                 for (uint16_t y = 0; y < source.height(); ++y)
+                 {
+                   memset(scratch, 0, sizeof(scratch));
+                   benchmarkSink ^= source.renderRow(y, scratch).data[i % 48];
+                 } });
+
+  static QrCode qr;
+
+  runBenchmark("barcode/QR encode (v3-M)", iterations, [&](size_t)
+               {
+                 qr.encode("https://example.com/p/0001234567", QrCode::Ecc::Medium);
+                 benchmarkSink ^= qr.symbolSize(); });
+
+  runBenchmark("barcode/QR render x4 all rows", iterations, [&](size_t i)
+               {
+                 QrRowSource source(qr, 16, 0, 4, 384, qr.moduleCount() * 4);
+                 for (uint16_t y = 0; y < source.height(); ++y)
+                 {
+                   memset(scratch, 0, sizeof(scratch));
+                   benchmarkSink ^= source.renderRow(y, scratch).data[i % 48];
+                 } });
+}
+
+// Horizontal ramp with a vertical ripple, generated per row
+class GradientSource : public GrayscaleSource
+{
+public:
+  uint16_t width() const override { return 384; }
+  uint16_t height() const override { return 240; }
+
+  const uint8_t *grayRow(uint16_t y, uint8_t *scratch) override
+  {
+    for (uint16_t x = 0; x < 384; ++x)
+    {
+      scratch[x] = static_cast<uint8_t>((x * 2 / 3 + (y & 31)) & 0xFF);
+    }
+
+    return scratch;
+  }
+};
+
+static void benchmarkDither()
+{
+  const size_t iterations = 10;
+
+  // Kept static: the error rows make a DitherRowSource too big for the stack
+  static GradientSource gradient;
+  static DitherRowSource bayer(gradient, DitherMode::Bayer8x8, 0, 0, 384, 240);
+  static DitherRowSource diffusion(gradient, DitherMode::FloydSteinberg, 0, 0, 384, 240);
+
+  DitherRowSource *sources[] = {&bayer, &diffusion};
+  const char *names[] = {"dither/Bayer 8x8 384x240", "dither/Floyd-Steinberg 384x240"};
+  uint8_t scratch[RowSource::MAX_ROW_BYTES];
+
+  for (size_t m = 0; m < 2; ++m)
+  {
+    RowSource &source = *sources[m];
+
+    runBenchmark(names[m], iterations, [&](size_t i)
+                 {
+                   for (uint16_t y = 0; y < source.height(); ++y)
+                   {
+                     memset(scratch, 0, sizeof(scratch));
+                     benchmarkSink ^= source.renderRow(y, scratch).data[i % 48];
+                   } });
+  }
+}
+
+static void benchmarkRotation()
+{
+  const size_t iterations = 10;
+  const uint16_t landscapeWidth = 384;
+  const uint16_t landscapeHeight = 240;
+
+  static uint8_t storage[Framebuffer::storageSizeFor(landscapeWidth, landscapeHeight)];
+  static Framebuffer landscape(landscapeWidth, landscapeHeight, storage);
+  static FramebufferRowSource landscapeRows(landscape);
+  static RotatedRowSource rotated(landscapeRows, Rotation::Quarter);
+
+  for (size_t i = 0; i < sizeof(storage); ++i)
+  {
+    storage[i] = static_cast<uint8_t>(i * 37);
+  }
+
+  uint8_t row[RowSource::MAX_ROW_BYTES];
+
+  // Baseline: one getPixel/bit-set per output pixel
+  runBenchmark("rotate/quarter turn bit by bit 384x240", iterations, [&](size_t i)
+               {
+                 for (uint16_t y = 0; y < landscapeWidth; ++y)
+                 {
+                   memset(row, 0, sizeof(row));
+
+                   for (uint16_t x = 0; x < landscapeHeight; ++x)
+                   {
+                     if (landscape.getPixel(y, landscapeHeight - 1 - x))
+                     {
+                       row[x / 8] |= 0x80 >> (x & 7);
+                     }
+                   }
+
+                   benchmarkSink ^= row[i % 30];
+                 } });
+
+  runBenchmark("rotate/quarter turn 8x8 tiles 384x240", iterations, [&](size_t i)
+               {
+                 for (uint16_t y = 0; y < rotated.height(); ++y)
+                 {
+                   benchmarkSink ^= rotated.renderRow(y, row).data[i % 30];
+                 } });
+}
+
+static void benchmarkPrintQueue()
+{
+  const size_t iterations = 500;
+  const size_t depth = 8;
+
+  // A typical bitmap row frame
+  uint8_t row[54] = {0x00, 0x20, 0x80, 0x32, 0x00, 0x01};
+  PrinterFrame frame(0x85, row, sizeof(row));
+
+  // Reference: the std::queue<std::vector<uint8_t>> the print queue used to be
+  std::queue<std::vector<uint8_t>> legacyQueue;
+
+  runBenchmark("queue/std::queue<vector> 8 in, 8 out", iterations, [&](size_t i)
+               {
+                 for (size_t n = 0; n < depth; ++n)
+                 {
+                   legacyQueue.push(std::vector<uint8_t>(frame.data(), frame.data() + frame.size()));
+                 }
+
+                 while (!legacyQueue.empty())
+                 {
+                   benchmarkSink ^= legacyQueue.front()[i % frame.size()];
+                   legacyQueue.pop();
+                 } });
+
+  static FrameQueue<2048> frameQueue;
+
+  runBenchmark("queue/FrameQueue 8 in, 8 out", iterations, [&](size_t i)
+               {
+                 for (size_t n = 0; n < depth; ++n)
+                 {
+                   frameQueue.push(frame.data(), frame.size());
+                 }
+
+                 size_t length;
+                 const uint8_t *data;
+
+                 while ((data = frameQueue.front(length)) != nullptr)
+                 {
+                   benchmarkSink ^= data[i % length];
+                   frameQueue.pop();
+                 } });
+
+  // Heap held by a full legacy queue, against the ring's fixed footprint
+  size_t heapBefore = heapInUse();
+
+  for (size_t n = 0; n < depth; ++n)
+  {
+    legacyQueue.push(std::vector<uint8_t>(frame.data(), frame.data() + frame.size()));
+  }
+
+  size_t legacyBytes = heapInUse() - heapBefore;
+
+  while (!legacyQueue.empty())
+  {
+    legacyQueue.pop();
+  }
+
+  for (size_t n = 0; n < depth; ++n)
+  {
+    frameQueue.push(frame.data(), frame.size());
+  }
+
+  size_t ringBytes = frameQueue.bytesUsed();
+
+  while (!frameQueue.empty())
+  {
+    frameQueue.pop();
+  }
+
+  report("queue: %u %u-byte frames take %u heap bytes in std::queue, %u of the %u fixed bytes in FrameQueue\n",
+         static_cast<unsigned>(depth),
+         static_cast<unsigned>(frame.size()),
+         static_cast<unsigned>(legacyBytes),
+         static_cast<unsigned>(ringBytes),
+         static_cast<unsigned>(sizeof(frameQueue)));
+}
+
+void runBenchmarks()
+{
+  report("Running benchmarks...\n");
+
+  benchmarkFrameBuilder();
+  benchmarkRowEncoder();
+  benchmarkTextRenderer();
+  benchmarkBarcodes();
+  benchmarkDither();
+  benchmarkRotation();
+  benchmarkPrintQueue();
+
+  report("Benchmarks done\n");
+}
+
+#endif
@@ -0,0 +1,185 @@
+#include "Code128.h"
+
+#include <string.h>
+
+#include "RowBits.h"
+
+namespace
+{
+  // Bar/space pattern of every symbol value, 11 modules, bars as set bits
+  const uint16_t SYMBOL_PATTERNS[] = {
+      0x6CC, 0x66C, 0x666, 0x498, 0x48C, 0x44C, 0x4C8, 0x4C4,
+      0x464, 0x648, 0x644, 0x624, 0x59C, 0x4DC, 0x4CE, 0x5CC,
+      0x4EC, 0x4E6, 0x672, 0x65C, 0x64E, 0x6E4, 0x674, 0x76E,
+      0x74C, 0x72C, 0x726, 0x764, 0x734, 0x732, 0x6D8, 0x6C6,
+      0x636, 0x518, 0x458, 0x446, 0x588, 0x468, 0x462, 0x688,
+      0x628, 0x622, 0x5B8, 0x58E, 0x46E, 0x5D8, 0x5C6, 0x476,
+      0x776, 0x68E, 0x62E, 0x6E8, 0x6E2, 0x6EE, 0x758, 0x746,
+      0x716, 0x768, 0x762, 0x71A, 0x77A, 0x642, 0x78A, 0x530,
+      0x50C, 0x4B0, 0x486, 0x42C, 0x426, 0x590, 0x584, 0x4D0,
+      0x4C2, 0x434, 0x432, 0x612, 0x650, 0x7BA, 0x614, 0x47A,
+      0x53C, 0x4BC, 0x49E, 0x5E4, 0x4F4, 0x4F2, 0x7A4, 0x794,
+      0x792, 0x6DE, 0x6F6, 0x7B6, 0x578, 0x51E, 0x45E, 0x5E8,
+      0x5E2, 0x7A8, 0x7A2, 0x5DE, 0x5EE, 0x75E, 0x7AE, 0x684,
+      0x690, 0x69C};
+
+  const uint16_t STOP_PATTERN = 0x18EB; // 13 modules
+  const uint8_t SYMBOL_MODULES = 11;
+  const uint8_t STOP_MODULES = 13;
+
+  const uint8_t CODE_C = 99;
+  const uint8_t CODE_B = 100;
+  const uint8_t START_B = 104;
+  const uint8_t START_C = 105;
+
+  size_t digitRun(const char *text)
+  {
+    size_t length = 0;
+
+    while (text[length] >= '0' && text[length] <= '9')
+    {
+      ++length;
+    }
+
+    return length;
+  }
+}
+
+bool Code128::push(uint8_t value)
+{
+  // Leave room for the checksum symbol
+  if (symbolCount + 1 >= MAX_SYMBOLS)
+  {
+    return false;
+  }
+
+  symbols[symbolCount++] = value;
+  return true;
+}
+
+bool Code128::encode(const char *text)
+{
+  symbolCount = 0;
+
+  size_t length = strlen(text);
+  size_t leadingDigits = digitRun(text);
+  bool codeC = leadingDigits == length ? length >= 2 && length % 2 == 0 : leadingDigits >= 4 && leadingDigits % 2 == 0;
+
+  push(codeC ? START_C : START_B);
+
+  for (const char *character = text; *character != '\0';)
+  {
+    size_t digits = digitRun(character);
+
+    // Code set C only pays off for longer runs of digit pairs
+    bool runAtEnd = character[digits] == '\0';
+    if (!codeC && (digits >= 6 || (runAtEnd && digits >= 4)) && digits % 2 == 0)
+    {
+      if (!push(CODE_C))
+      {
+        return false;
+      }
+
+      codeC = true;
+    }
+
+    if (codeC)
+    {
+      if (digits >= 2)
+      {
+        if (!push((character[0] - '0') * 10 + (character[1] - '0')))
+        {
+          return false;
+        }
+
+        character += 2;
+        continue;
+      }
+
+      if (!push(CODE_B))
+      {
+        return false;
+      }
+
+      codeC = false;
+    }
+
+    unsigned char value = static_cast<unsigned char>(*character);
+
+    if (value < ' ' || value > 127 || !push(value - ' '))
+    {
+      return false;
+    }
+
+    ++character;
+  }
+
+  uint32_t checksum = symbols[0];
+  for (size_t i = 1; i < symbolCount; ++i)
+  {
+    checksum += i * symbols[i];
+  }
+
+  symbols[symbolCount++] = checksum % 103;
+  return true;
+}
+
+uint16_t Code128::moduleCount() const
+{
+  return QUIET_ZONE_MODULES * 2 + symbolCount * SYMBOL_MODULES + STOP_MODULES;
+}
+
+void Code128::renderRow(uint16_t x, uint8_t moduleWidth, uint8_t *row, size_t rowBytes) const
+{
+  uint32_t position = x + QUIET_ZONE_MODULES * moduleWidth;
+
+  for (size_t i = 0; i <= symbolCount; ++i)
+  {
+    uint16_t pattern = i < symbolCount ? SYMBOL_PATTERNS[symbols[i]] : STOP_PATTERN;
+    uint8_t modules = i < symbolCount ? SYMBOL_MODULES : STOP_MODULES;
+
+    // Walk the pattern a bar at a time rather than a module at a time
+    for (int bit = modules - 1; bit >= 0;)
+    {
+      bool bar = pattern & (1 << bit);
+      int runEnd = bit;
+
+      while (runEnd >= 0 && static_cast<bool>(pattern & (1 << runEnd)) == bar)
+      {
+        --runEnd;
+      }
+
+      uint32_t runWidth = (bit - runEnd) * moduleWidth;
+
+      if (bar)
+      {
+        fillRowBits(row, rowBytes, position, runWidth);
+      }
+
+      position += runWidth;
+      bit = runEnd;
+    }
+  }
+}
+
+Code128RowSource::Code128RowSource(const Code128 &barcode, uint16_t x, uint16_t y, uint8_t moduleWidth, uint16_t barHeight, uint16_t width, uint16_t height)
+    : top(y), barHeight(barHeight), columns(width), rows(height)
+{
+  size_t rowBytes = (width + 7) / 8;
+
+  memset(barRow, 0, sizeof(barRow));
+  barcode.renderRow(x, moduleWidth, barRow, rowBytes < MAX_ROW_BYTES ? rowBytes : MAX_ROW_BYTES);
+}
+
+RowSpan Code128RowSource::renderRow(uint16_t y, uint8_t *scratch)
+{
+  size_t rowBytes = (columns + 7) / 8;
+
+  if (rowBytes > MAX_ROW_BYTES)
+  {
+    rowBytes = MAX_ROW_BYTES;
+  }
+
+  RowSpan span = {y >= top && y < top + barHeight ? barRow : scratch, rowBytes};
+  return span;
+}
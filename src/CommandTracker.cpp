@@ -0,0 +1,118 @@
+#include "CommandTracker.h"
+
+bool CommandTracker::track(uint8_t commandCode, CommandCallback callback, void *context, uint32_t now, uint32_t timeoutMs)
+{
+  for (size_t i = 0; i < MAX_IN_FLIGHT; ++i)
+  {
+    if (pending[i].active)
+    {
+      continue;
+    }
+
+    pending[i] = {true, commandCode, nextSequence++, now + timeoutMs, callback, context};
+    ++count;
+    return true;
+  }
+
+  return false;
+}
+
+// Heartbeats and status polls run all the time and are never what the
+// printer refuses, so error replies don't blame them
+static bool canBeRejected(uint8_t commandCode)
+{
+  return commandCode != PrinterCommands::HEARTBEAT && commandCode != PrinterCommands::GET_PRINT_STATUS;
+}
+
+bool CommandTracker::resolve(const PrinterResponse &response)
+{
+  // Error replies don't say which command they belong to, blame the most
+  // recent one that could have failed; answers go to the oldest they match
+  bool isError = response.code == PrinterResponses::PRINT_ERROR || response.code == PrinterResponses::NOT_SUPPORTED;
+  size_t match = MAX_IN_FLIGHT;
+
+  for (size_t i = 0; i < MAX_IN_FLIGHT; ++i)
+  {
+    if (!pending[i].active)
+    {
+      continue;
+    }
+
+    if (isError ? !canBeRejected(pending[i].commandCode) : !isResponseTo(pending[i].commandCode, response.code))
+    {
+      continue;
+    }
+
+    if (match == MAX_IN_FLIGHT)
+    {
+      match = i;
+      continue;
+    }
+
+    int32_t sentAfter = static_cast<int32_t>(pending[i].sequence - pending[match].sequence);
+
+    if (isError ? sentAfter > 0 : sentAfter < 0)
+    {
+      match = i;
+    }
+  }
+
+  if (match == MAX_IN_FLIGHT)
+  {
+    return false;
+  }
+
+  complete(match, isError ? CommandResult::Rejected : CommandResult::Completed, response);
+  return true;
+}
+
+void CommandTracker::expire(uint32_t now)
+{
+  const PrinterResponse noResponse = {0, nullptr, 0};
+
+  for (size_t i = 0; i < MAX_IN_FLIGHT; ++i)
+  {
+    if (pending[i].active && static_cast<int32_t>(now - pending[i].deadline) >= 0)
+    {
+      complete(i, CommandResult::TimedOut, noResponse);
+    }
+  }
+}
+
+void CommandTracker::cancelAll()
+{
+  for (size_t i = 0; i < MAX_IN_FLIGHT; ++i)
+  {
+    pending[i].active = false;
+  }
+
+  count = 0;
+}
+
+bool CommandTracker::isTracking(uint8_t commandCode) const
+{
+  for (size_t i = 0; i < MAX_IN_FLIGHT; ++i)
+  {
+    if (pending[i].active && pending[i].commandCode == commandCode)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void CommandTracker::complete(size_t index, CommandResult result, const PrinterResponse &response)
+{
+  CommandCallback callback = pending[index].callback;
+  void *context = pending[index].context;
+
+  // Free the slot first so the callback can issue follow-up commands
+  pending[index].active = false;
+  --count;
+
+  if (callback != nullptr)
+  {
+    callback(result, response, context);
+  }
+}
@@ -0,0 +1,161 @@
+#include "Dither.h"
+
+#include <string.h>
+
+DitherRowSource::DitherRowSource(GrayscaleSource &image, DitherMode mode, uint16_t x, uint16_t y, uint16_t width, uint16_t height)
+    : image(image), mode(mode), left(x), top(y), columns(width), rows(height),
+      imageFits(image.width() <= MAX_WIDTH), nextImageRow(0)
+{
+  resetErrors();
+}
+
+void DitherRowSource::resetErrors()
+{
+  memset(errors, 0, sizeof(errors));
+  nextImageRow = 0;
+}
+
+uint16_t DitherRowSource::visibleWidth(size_t rowBytes) const
+{
+  uint32_t limit = rowBytes * 8;
+
+  if (columns < limit)
+  {
+    limit = columns;
+  }
+
+  if (left >= limit)
+  {
+    return 0;
+  }
+
+  uint32_t count = limit - left;
+
+  if (count > image.width())
+  {
+    count = image.width();
+  }
+
+  return count > MAX_WIDTH ? MAX_WIDTH : count;
+}
+
+// Black pixels are collected into a whole output byte before touching the row
+static inline void packPixel(uint8_t *row, uint32_t x, bool black, uint8_t &pending)
+{
+  if (black)
+  {
+    pending |= 0x80 >> (x & 7);
+  }
+
+  if ((x & 7) == 7)
+  {
+    row[x / 8] |= pending;
+    pending = 0;
+  }
+}
+
+void DitherRowSource::ditherOrdered(const uint8_t *gray, uint16_t imageRow, uint16_t count, uint8_t *row)
+{
+  static const uint8_t flatThreshold = THRESHOLD;
+  const uint8_t *thresholds;
+  size_t order;
+
+  switch (mode)
+  {
+  case DitherMode::Bayer4x4:
+    thresholds = BayerMatrices::BAYER_4X4.data() + (imageRow & 3) * 4;
+    order = 4;
+    break;
+  case DitherMode::Bayer8x8:
+    thresholds = BayerMatrices::BAYER_8X8.data() + (imageRow & 7) * 8;
+    order = 8;
+    break;
+  default:
+    thresholds = &flatThreshold;
+    order = 1;
+    break;
+  }
+
+  uint8_t pending = 0;
+  uint32_t x = left;
+
+  for (uint16_t i = 0; i < count; ++i, ++x)
+  {
+    packPixel(row, x, gray[i] < thresholds[i & (order - 1)], pending);
+  }
+
+  row[(x - 1) / 8] |= pending;
+}
+
+void DitherRowSource::ditherFloydSteinberg(const uint8_t *gray, uint16_t imageRow, uint16_t count, uint8_t *row)
+{
+  int16_t *current = errors[imageRow & 1];
+  int16_t *below = errors[(imageRow + 1) & 1];
+
+  memset(below, 0, (count + 2) * sizeof(int16_t));
+
+  // Each error is at most +-255, so the 7/16 + 5/16 + 3/16 + 1/16 spread
+  // of its neighbours never leaves int16_t
+  uint8_t pending = 0;
+  uint32_t x = left;
+
+  for (uint16_t i = 0; i < count; ++i, ++x)
+  {
+    int16_t value = gray[i] + ((current[i + 1] + 8) >> 4);
+    bool black = value < THRESHOLD;
+    int16_t error = black ? value : value - 255;
+
+    current[i + 2] += error * 7;
+    below[i] += error * 3;
+    below[i + 1] += error * 5;
+    below[i + 2] += error;
+
+    packPixel(row, x, black, pending);
+  }
+
+  row[(x - 1) / 8] |= pending;
+}
+
+RowSpan DitherRowSource::renderRow(uint16_t y, uint8_t *scratch)
+{
+  size_t rowBytes = (columns + 7) / 8;
+
+  if (rowBytes > MAX_ROW_BYTES)
+  {
+    rowBytes = MAX_ROW_BYTES;
+  }
+
+  RowSpan span = {scratch, rowBytes};
+  uint16_t count = visibleWidth(rowBytes);
+
+  if (!imageFits || y < top || y - top >= image.height() || count == 0)
+  {
+    return span;
+  }
+
+  uint16_t imageRow = y - top;
+
+  if (mode != DitherMode::FloydSteinberg)
+  {
+    ditherOrdered(image.grayRow(imageRow, grayScratch), imageRow, count, scratch);
+    return span;
+  }
+
+  if (imageRow == 0 || imageRow < nextImageRow)
+  {
+    resetErrors();
+  }
+
+  // Rows skipped by the caller still carry error into the one asked for
+  while (nextImageRow < imageRow)
+  {
+    ditherFloydSteinberg(image.grayRow(nextImageRow, grayScratch), nextImageRow, count, scratch);
+    ++nextImageRow;
+  }
+
+  memset(scratch, 0, rowBytes);
+  ditherFloydSteinberg(image.grayRow(imageRow, grayScratch), imageRow, count, scratch);
+  nextImageRow = imageRow + 1;
+
+  return span;
+}
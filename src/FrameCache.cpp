@@ -0,0 +1,399 @@
+#include "FrameCache.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <LittleFS.h>
+
+#include "PrinterProtocol.h"
+
+static const char *CACHE_DIRECTORY = "/frames";
+static const char *INDEX_PATH = "/frames/index";
+static const char *RECORDING_PATH = "/frames/recording";
+
+FrameCache::FrameCache()
+    : hits(0), misses(0), stores(0), evictions(0), corruptions(0),
+      count(0), useClock(0), mounted(false),
+      reading(false), damaged(false), readingKey(0), writing(false), writeFailed(false), recordingKey(0), recordedBytes(0)
+{
+}
+
+bool FrameCache::begin()
+{
+  mounted = LittleFS.begin(true);
+
+  if (!mounted)
+  {
+    return false;
+  }
+
+  if (!LittleFS.exists(CACHE_DIRECTORY))
+  {
+    LittleFS.mkdir(CACHE_DIRECTORY);
+  }
+
+  // A recording interrupted by a reset is never committed
+  if (LittleFS.exists(RECORDING_PATH))
+  {
+    LittleFS.remove(RECORDING_PATH);
+  }
+
+  loadIndex();
+  removeOrphans();
+  return true;
+}
+
+void FrameCache::pathFor(uint64_t key, char *path, size_t size)
+{
+  snprintf(path, size, "%s/%08lx%08lx", CACHE_DIRECTORY,
+           static_cast<unsigned long>(key >> 32),
+           static_cast<unsigned long>(key & 0xFFFFFFFF));
+}
+
+int FrameCache::find(uint64_t key) const
+{
+  for (size_t i = 0; i < count; ++i)
+  {
+    if (entries[i].key == key)
+    {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+bool FrameCache::contains(uint64_t key) const
+{
+  return find(key) >= 0;
+}
+
+uint32_t FrameCache::totalBytes() const
+{
+  uint32_t total = 0;
+
+  for (size_t i = 0; i < count; ++i)
+  {
+    total += entries[i].size;
+  }
+
+  return total;
+}
+
+void FrameCache::loadIndex()
+{
+  count = 0;
+  useClock = 0;
+
+  File index = LittleFS.open(INDEX_PATH, FILE_READ);
+
+  if (!index)
+  {
+    return;
+  }
+
+  Entry entry;
+  char path[32];
+
+  while (count < MAX_ENTRIES && index.read(reinterpret_cast<uint8_t *>(&entry), sizeof(entry)) == sizeof(entry))
+  {
+    pathFor(entry.key, path, sizeof(path));
+
+    // Drop entries whose stream didn't survive
+    if (!LittleFS.exists(path))
+    {
+      continue;
+    }
+
+    entries[count++] = entry;
+
+    if (entry.lastUsed > useClock)
+    {
+      useClock = entry.lastUsed;
+    }
+  }
+
+  index.close();
+}
+
+// Streams the index doesn't know about, e.g. left by a reset between the
+// rename of a recording and the index write, would hold flash forever
+void FrameCache::removeOrphans()
+{
+  File directory = LittleFS.open(CACHE_DIRECTORY);
+
+  if (!directory)
+  {
+    return;
+  }
+
+  char orphans[MAX_ENTRIES][32];
+  size_t orphanCount = 0;
+  char path[32];
+
+  for (File file = directory.openNextFile(); file && orphanCount < MAX_ENTRIES; file = directory.openNextFile())
+  {
+    // Older cores report the full path, newer ones only the file name
+    const char *name = strrchr(file.name(), '/');
+    snprintf(path, sizeof(path), "%s/%s", CACHE_DIRECTORY, name != nullptr ? name + 1 : file.name());
+    file.close();
+
+    bool known = strcmp(path, INDEX_PATH) == 0;
+
+    for (size_t i = 0; i < count && !known; ++i)
+    {
+      char entryPath[32];
+      pathFor(entries[i].key, entryPath, sizeof(entryPath));
+      known = strcmp(path, entryPath) == 0;
+    }
+
+    if (!known)
+    {
+      strcpy(orphans[orphanCount++], path);
+    }
+  }
+
+  directory.close();
+
+  // Removed once the directory is closed, not while it is being listed
+  for (size_t i = 0; i < orphanCount; ++i)
+  {
+    LittleFS.remove(orphans[i]);
+  }
+}
+
+void FrameCache::saveIndex()
+{
+  File index = LittleFS.open(INDEX_PATH, FILE_WRITE);
+
+  if (!index)
+  {
+    return;
+  }
+
+  index.write(reinterpret_cast<const uint8_t *>(entries), count * sizeof(Entry));
+  index.close();
+}
+
+void FrameCache::remove(size_t index)
+{
+  char path[32];
+  pathFor(entries[index].key, path, sizeof(path));
+  LittleFS.remove(path);
+
+  entries[index] = entries[--count];
+}
+
+void FrameCache::evictLeastRecentlyUsed()
+{
+  size_t victim = 0;
+
+  for (size_t i = 1; i < count; ++i)
+  {
+    if (entries[i].lastUsed < entries[victim].lastUsed)
+    {
+      victim = i;
+    }
+  }
+
+  remove(victim);
+  ++evictions;
+}
+
+bool FrameCache::open(uint64_t key)
+{
+  close();
+
+  int index = mounted ? find(key) : -1;
+  damaged = false;
+
+  if (index >= 0)
+  {
+    char path[32];
+    pathFor(key, path, sizeof(path));
+    reader = LittleFS.open(path, FILE_READ);
+
+    // A stream cut short on flash is caught here, before any of it is sent
+    if (!reader || reader.size() != entries[index].size)
+    {
+      if (reader)
+      {
+        reader.close();
+        ++corruptions;
+      }
+
+      remove(index);
+      saveIndex();
+      index = -1;
+    }
+  }
+
+  if (index < 0)
+  {
+    ++misses;
+    return false;
+  }
+
+  ++hits;
+  entries[index].lastUsed = ++useClock;
+
+  reading = true;
+  readingKey = key;
+  return true;
+}
+
+bool FrameCache::readFrame(uint8_t *buffer, size_t capacity, size_t &length)
+{
+  if (!reading || capacity < PrinterFraming::OVERHEAD)
+  {
+    return false;
+  }
+
+  if (reader.available() == 0)
+  {
+    return false; // end of the stream
+  }
+
+  // Flash can go bad under a frame after it was recorded, so every frame is
+  // checked in full before it goes back to the printer
+  bool valid = reader.read(buffer, PrinterFraming::HEADER_SIZE) == PrinterFraming::HEADER_SIZE &&
+               buffer[0] == PrinterFraming::START_BYTE && buffer[1] == PrinterFraming::START_BYTE;
+
+  if (valid)
+  {
+    length = buffer[3] + PrinterFraming::OVERHEAD;
+    size_t rest = length - PrinterFraming::HEADER_SIZE;
+
+    valid = length <= capacity &&
+            reader.read(buffer + PrinterFraming::HEADER_SIZE, rest) == rest &&
+            buffer[length - 2] == PrinterFraming::END_BYTE &&
+            buffer[length - 1] == PrinterFraming::END_BYTE;
+  }
+
+  if (valid)
+  {
+    uint8_t checksum = 0;
+
+    for (size_t i = 2; i < length - 3; ++i)
+    {
+      checksum ^= buffer[i];
+    }
+
+    valid = buffer[length - 3] == checksum;
+  }
+
+  if (!valid)
+  {
+    // Damaged on flash, the caller renders what is left and the label is
+    // recorded again next time
+    close();
+    ++corruptions;
+    damaged = true;
+
+    int index = find(readingKey);
+
+    if (index >= 0)
+    {
+      remove(index);
+      saveIndex();
+    }
+  }
+
+  return valid;
+}
+
+void FrameCache::close()
+{
+  if (reading)
+  {
+    reader.close();
+    reading = false;
+  }
+}
+
+void FrameCache::beginRecording(uint64_t key)
+{
+  abortRecording();
+
+  if (!mounted)
+  {
+    return;
+  }
+
+  writer = LittleFS.open(RECORDING_PATH, FILE_WRITE);
+  writing = static_cast<bool>(writer);
+  writeFailed = false;
+  recordingKey = key;
+  recordedBytes = 0;
+}
+
+void FrameCache::record(const uint8_t *frame, size_t length)
+{
+  if (!writing || writeFailed)
+  {
+    return;
+  }
+
+  recordedBytes += length;
+
+  // Streams that would never fit the budget are not worth writing out
+  if (recordedBytes > MAX_BYTES || writer.write(frame, length) != length)
+  {
+    writeFailed = true;
+  }
+}
+
+bool FrameCache::commitRecording()
+{
+  if (!writing)
+  {
+    return false;
+  }
+
+  writer.close();
+  writing = false;
+
+  if (writeFailed)
+  {
+    LittleFS.remove(RECORDING_PATH);
+    return false;
+  }
+
+  int existing = find(recordingKey);
+
+  if (existing >= 0)
+  {
+    remove(existing);
+  }
+
+  while (count > 0 && (count >= MAX_ENTRIES || totalBytes() + recordedBytes > MAX_BYTES))
+  {
+    evictLeastRecentlyUsed();
+  }
+
+  char path[32];
+  pathFor(recordingKey, path, sizeof(path));
+
+  if (!LittleFS.rename(RECORDING_PATH, path))
+  {
+    LittleFS.remove(RECORDING_PATH);
+    saveIndex();
+    return false;
+  }
+
+  entries[count++] = {recordingKey, recordedBytes, ++useClock};
+  saveIndex();
+  ++stores;
+
+  return true;
+}
+
+void FrameCache::abortRecording()
+{
+  if (writing)
+  {
+    writer.close();
+    writing = false;
+    LittleFS.remove(RECORDING_PATH);
+  }
+}
@@ -0,0 +1,99 @@
+#include "Framebuffer.h"
+
+#include <new>
+#include <string.h>
+
+Framebuffer::Framebuffer(uint16_t width, uint16_t height)
+    : columns(width), rows(height), rowStride(strideFor(width)), ownsPixels(true)
+{
+  pixels = new (std::nothrow) uint8_t[storageSizeFor(width, height)];
+  clear();
+}
+
+Framebuffer::Framebuffer(uint16_t width, uint16_t height, uint8_t *storage)
+    : columns(width), rows(height), rowStride(strideFor(width)), pixels(storage), ownsPixels(false)
+{
+  clear();
+}
+
+Framebuffer::~Framebuffer()
+{
+  if (ownsPixels)
+  {
+    delete[] pixels;
+  }
+}
+
+void Framebuffer::clear()
+{
+  if (pixels != nullptr)
+  {
+    memset(pixels, 0, rowStride * rows);
+  }
+}
+
+void Framebuffer::setPixel(uint16_t x, uint16_t y, bool black)
+{
+  if (x >= columns || y >= rows)
+  {
+    return;
+  }
+
+  uint8_t mask = 0x80 >> (x & 7);
+  uint8_t &byte = pixels[y * rowStride + x / 8];
+
+  byte = black ? byte | mask : byte & ~mask;
+}
+
+bool Framebuffer::getPixel(uint16_t x, uint16_t y) const
+{
+  if (x >= columns || y >= rows)
+  {
+    return false;
+  }
+
+  return pixels[y * rowStride + x / 8] & (0x80 >> (x & 7));
+}
+
+void Framebuffer::fillRect(uint16_t x, uint16_t y, uint16_t width, uint16_t height, bool black)
+{
+  uint16_t right = x + width > columns ? columns : x + width;
+  uint16_t bottom = y + height > rows ? rows : y + height;
+
+  if (x >= right || y >= bottom)
+  {
+    return;
+  }
+
+  for (uint16_t row = y; row < bottom; ++row)
+  {
+    uint8_t *line = pixels + row * rowStride;
+    uint16_t column = x;
+
+    // Ragged leading bits, then whole bytes, then ragged trailing bits
+    while (column < right && (column & 7) != 0)
+    {
+      setPixel(column++, row, black);
+    }
+
+    size_t wholeBytes = (right - column) / 8;
+    memset(line + column / 8, black ? 0xFF : 0x00, wholeBytes);
+    column += wholeBytes * 8;
+
+    while (column < right)
+    {
+      setPixel(column++, row, black);
+    }
+  }
+}
+
+void Framebuffer::setRow(uint16_t y, const uint8_t *data, size_t length)
+{
+  if (y >= rows)
+  {
+    return;
+  }
+
+  size_t rowBytes = (columns + 7) / 8;
+  memcpy(pixels + y * rowStride, data, length < rowBytes ? length : rowBytes);
+}
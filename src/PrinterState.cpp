@@ -0,0 +1,59 @@
+#include "PrinterState.h"
+
+// A zero closing or paper state means closed or loaded, as niimblue reads them
+bool PrinterState::applyHeartbeat(const uint8_t *payload, size_t length, uint32_t now)
+{
+  switch (length)
+  {
+  case 20:
+    paperPresent.set(payload[18] == 0, now);
+    rfidReadState.set(payload[19], now);
+    return true;
+
+  case 19:
+    lidClosed.set(payload[15] == 0, now);
+    batteryLevel.set(payload[16], now);
+    paperPresent.set(payload[17] == 0, now);
+    rfidReadState.set(payload[18], now);
+    return true;
+
+  case 13:
+    lidClosed.set(payload[9] == 0, now);
+    batteryLevel.set(payload[10], now);
+    paperPresent.set(payload[11] == 0, now);
+    rfidReadState.set(payload[12], now);
+    return true;
+
+  case 10:
+    lidClosed.set(payload[8] == 0, now);
+    batteryLevel.set(payload[9], now);
+    return true;
+
+  case 9:
+    lidClosed.set(payload[8] == 0, now);
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+const char *PrinterState::printBlocker(uint32_t now, uint32_t maxAgeMs) const
+{
+  if (lidClosed.freshAt(now, maxAgeMs) && !lidClosed.value)
+  {
+    return "lid open";
+  }
+
+  if (paperPresent.freshAt(now, maxAgeMs) && !paperPresent.value)
+  {
+    return "no labels loaded";
+  }
+
+  if (errorCode.freshAt(now, maxAgeMs) && errorCode.value != 0)
+  {
+    return "printer error";
+  }
+
+  return nullptr;
+}
@@ -0,0 +1,591 @@
+#include "QrCode.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "RowBits.h"
+
+namespace
+{
+  // Indexed by [ecc][version], version 0 unused
+  const uint8_t ECC_CODEWORDS_PER_BLOCK[4][QrCode::MAX_VERSION + 1] = {
+      {0, 7, 10, 15, 20, 26, 18, 20, 24, 30, 18},
+      {0, 10, 16, 26, 18, 24, 16, 18, 22, 22, 26},
+      {0, 13, 22, 18, 26, 18, 24, 18, 22, 20, 24},
+      {0, 17, 28, 22, 16, 22, 28, 26, 26, 24, 28}};
+
+  const uint8_t ERROR_CORRECTION_BLOCKS[4][QrCode::MAX_VERSION + 1] = {
+      {0, 1, 1, 1, 1, 1, 2, 2, 2, 2, 4},
+      {0, 1, 1, 1, 2, 2, 4, 4, 4, 5, 5},
+      {0, 1, 1, 2, 2, 4, 4, 6, 6, 8, 8},
+      {0, 1, 1, 2, 4, 4, 4, 5, 6, 8, 8}};
+
+  // Format information encodes L, M, Q, H as 1, 0, 3, 2
+  const uint8_t FORMAT_BITS[4] = {1, 0, 3, 2};
+
+  const size_t MAX_CODEWORDS = 346; // version 10
+  const size_t MAX_ECC_CODEWORDS = 30;
+  const size_t MAX_BLOCKS = 8;
+  const size_t MAX_BLOCK_LENGTH = 147; // version 9, low ECC
+
+  size_t rawDataModules(uint8_t version)
+  {
+    size_t result = (16 * version + 128) * version + 64;
+
+    if (version >= 2)
+    {
+      size_t alignments = version / 7 + 2;
+      result -= (25 * alignments - 10) * alignments - 55;
+
+      if (version >= 7)
+      {
+        result -= 36;
+      }
+    }
+
+    return result;
+  }
+
+  size_t dataCodewords(uint8_t version, QrCode::Ecc ecc)
+  {
+    uint8_t level = static_cast<uint8_t>(ecc);
+    return rawDataModules(version) / 8 - ECC_CODEWORDS_PER_BLOCK[level][version] * ERROR_CORRECTION_BLOCKS[level][version];
+  }
+
+  uint8_t gfMultiply(uint8_t x, uint8_t y)
+  {
+    uint16_t z = 0;
+
+    for (int i = 7; i >= 0; --i)
+    {
+      z = (z << 1) ^ ((z >> 7) * 0x11D);
+      z ^= ((y >> i) & 1) * x;
+    }
+
+    return static_cast<uint8_t>(z);
+  }
+
+  void reedSolomonDivisor(uint8_t degree, uint8_t *divisor)
+  {
+    memset(divisor, 0, degree);
+    divisor[degree - 1] = 1;
+
+    uint8_t root = 1;
+    for (uint8_t i = 0; i < degree; ++i)
+    {
+      for (uint8_t j = 0; j < degree; ++j)
+      {
+        divisor[j] = gfMultiply(divisor[j], root);
+
+        if (j + 1 < degree)
+        {
+          divisor[j] ^= divisor[j + 1];
+        }
+      }
+
+      root = gfMultiply(root, 0x02);
+    }
+  }
+
+  void reedSolomonRemainder(const uint8_t *data, size_t length, const uint8_t *divisor, uint8_t degree, uint8_t *remainder)
+  {
+    memset(remainder, 0, degree);
+
+    for (size_t i = 0; i < length; ++i)
+    {
+      uint8_t factor = data[i] ^ remainder[0];
+
+      memmove(remainder, remainder + 1, degree - 1);
+      remainder[degree - 1] = 0;
+
+      for (uint8_t j = 0; j < degree; ++j)
+      {
+        remainder[j] ^= gfMultiply(divisor[j], factor);
+      }
+    }
+  }
+
+  class BitWriter
+  {
+  public:
+    BitWriter(uint8_t *buffer, size_t capacity) : buffer(buffer), bitLength(0)
+    {
+      memset(buffer, 0, capacity);
+    }
+
+    void append(uint32_t value, uint8_t bits)
+    {
+      for (int i = bits - 1; i >= 0; --i, ++bitLength)
+      {
+        if ((value >> i) & 1)
+        {
+          buffer[bitLength >> 3] |= 0x80 >> (bitLength & 7);
+        }
+      }
+    }
+
+    size_t length() const { return bitLength; }
+
+  private:
+    uint8_t *buffer;
+    size_t bitLength;
+  };
+
+  bool maskBit(uint8_t mask, int x, int y)
+  {
+    switch (mask)
+    {
+    case 0:
+      return (x + y) % 2 == 0;
+    case 1:
+      return y % 2 == 0;
+    case 2:
+      return x % 3 == 0;
+    case 3:
+      return (x + y) % 3 == 0;
+    case 4:
+      return (x / 3 + y / 2) % 2 == 0;
+    case 5:
+      return x * y % 2 + x * y % 3 == 0;
+    case 6:
+      return (x * y % 2 + x * y % 3) % 2 == 0;
+    default:
+      return ((x + y) % 2 + x * y % 3) % 2 == 0;
+    }
+  }
+}
+
+bool QrCode::encode(const char *text, Ecc ecc)
+{
+  return encode(reinterpret_cast<const uint8_t *>(text), strlen(text), ecc);
+}
+
+bool QrCode::encode(const uint8_t *data, size_t length, Ecc ecc)
+{
+  // Smallest version whose capacity holds mode, count and payload bits
+  version = 0;
+  for (uint8_t candidate = 1; candidate <= MAX_VERSION; ++candidate)
+  {
+    size_t countBits = candidate <= 9 ? 8 : 16;
+
+    if (4 + countBits + length * 8 <= dataCodewords(candidate, ecc) * 8)
+    {
+      version = candidate;
+      break;
+    }
+  }
+
+  if (version == 0)
+  {
+    size = 0;
+    return false;
+  }
+
+  size = version * 4 + 17;
+
+  uint8_t level = static_cast<uint8_t>(ecc);
+  size_t dataCapacity = dataCodewords(version, ecc);
+  uint8_t codewords[MAX_CODEWORDS];
+  BitWriter writer(codewords, sizeof(codewords));
+
+  writer.append(0x4, 4); // byte mode
+  writer.append(length, version <= 9 ? 8 : 16);
+
+  for (size_t i = 0; i < length; ++i)
+  {
+    writer.append(data[i], 8);
+  }
+
+  size_t capacityBits = dataCapacity * 8;
+  size_t terminator = capacityBits - writer.length() < 4 ? capacityBits - writer.length() : 4;
+  writer.append(0, terminator);
+  writer.append(0, (8 - writer.length() % 8) % 8);
+
+  for (uint8_t pad = 0xEC; writer.length() < capacityBits; pad ^= 0xEC ^ 0x11)
+  {
+    writer.append(pad, 8);
+  }
+
+  // Split into blocks, add error correction to each and interleave
+  uint8_t blockCount = ERROR_CORRECTION_BLOCKS[level][version];
+  uint8_t blockEccLength = ECC_CODEWORDS_PER_BLOCK[level][version];
+  size_t rawCodewords = rawDataModules(version) / 8;
+  size_t shortBlocks = blockCount - rawCodewords % blockCount;
+  size_t shortBlockLength = rawCodewords / blockCount;
+
+  uint8_t blocks[MAX_BLOCKS][MAX_BLOCK_LENGTH];
+  uint8_t divisor[MAX_ECC_CODEWORDS];
+  reedSolomonDivisor(blockEccLength, divisor);
+
+  for (size_t i = 0, offset = 0; i < blockCount; ++i)
+  {
+    size_t dataLength = shortBlockLength - blockEccLength + (i < shortBlocks ? 0 : 1);
+    uint8_t *block = blocks[i];
+
+    memcpy(block, codewords + offset, dataLength);
+    offset += dataLength;
+
+    // Short blocks get a placeholder so every block has the same layout
+    size_t eccOffset = shortBlockLength + 1 - blockEccLength;
+    reedSolomonRemainder(block, dataLength, divisor, blockEccLength, block + eccOffset);
+  }
+
+  uint8_t interleaved[MAX_CODEWORDS];
+  size_t count = 0;
+
+  for (size_t i = 0; i <= shortBlockLength; ++i)
+  {
+    for (size_t j = 0; j < blockCount; ++j)
+    {
+      if (i != shortBlockLength - blockEccLength || j >= shortBlocks)
+      {
+        interleaved[count++] = blocks[j][i];
+      }
+    }
+  }
+
+  memset(modules, 0, sizeof(modules));
+  memset(functionModules, 0, sizeof(functionModules));
+
+  drawFunctionPatterns(ecc);
+  drawCodewords(interleaved, count);
+
+  uint8_t bestMask = 0;
+  uint32_t bestPenalty = UINT32_MAX;
+
+  for (uint8_t mask = 0; mask < 8; ++mask)
+  {
+    applyMask(mask);
+    drawFormatBits(ecc, mask);
+
+    uint32_t penalty = penaltyScore();
+    if (penalty < bestPenalty)
+    {
+      bestMask = mask;
+      bestPenalty = penalty;
+    }
+
+    applyMask(mask); // XOR again to undo
+  }
+
+  applyMask(bestMask);
+  drawFormatBits(ecc, bestMask);
+  return true;
+}
+
+void QrCode::setModule(uint8_t x, uint8_t y, bool dark)
+{
+  size_t index = y * size + x;
+  uint8_t mask = 0x80 >> (index & 7);
+
+  modules[index >> 3] = dark ? modules[index >> 3] | mask : modules[index >> 3] & ~mask;
+}
+
+void QrCode::setFunctionModule(uint8_t x, uint8_t y, bool dark)
+{
+  size_t index = y * size + x;
+
+  setModule(x, y, dark);
+  functionModules[index >> 3] |= 0x80 >> (index & 7);
+}
+
+void QrCode::drawFunctionPatterns(Ecc ecc)
+{
+  for (uint8_t i = 0; i < size; ++i)
+  {
+    setFunctionModule(6, i, i % 2 == 0);
+    setFunctionModule(i, 6, i % 2 == 0);
+  }
+
+  drawFinderPattern(3, 3);
+  drawFinderPattern(size - 4, 3);
+  drawFinderPattern(3, size - 4);
+
+  if (version >= 2)
+  {
+    uint8_t alignments = version / 7 + 2;
+    uint8_t step = (version * 4 + alignments * 2 + 1) / (alignments * 2 - 2) * 2;
+    uint8_t positions[7];
+
+    positions[0] = 6;
+    for (uint8_t i = alignments - 1, position = size - 7; i >= 1; --i, position -= step)
+    {
+      positions[i] = position;
+    }
+
+    for (uint8_t i = 0; i < alignments; ++i)
+    {
+      for (uint8_t j = 0; j < alignments; ++j)
+      {
+        // Skip the three corners occupied by finder patterns
+        bool corner = (i == 0 && j == 0) || (i == 0 && j == alignments - 1) || (i == alignments - 1 && j == 0);
+
+        if (!corner)
+        {
+          drawAlignmentPattern(positions[i], positions[j]);
+        }
+      }
+    }
+  }
+
+  // Reserve the format areas now, the real bits depend on the mask
+  drawFormatBits(ecc, 0);
+  drawVersion();
+}
+
+void QrCode::drawFinderPattern(int x, int y)
+{
+  for (int dy = -4; dy <= 4; ++dy)
+  {
+    for (int dx = -4; dx <= 4; ++dx)
+    {
+      int distance = abs(dx) > abs(dy) ? abs(dx) : abs(dy);
+      int xx = x + dx;
+      int yy = y + dy;
+
+      if (xx >= 0 && xx < size && yy >= 0 && yy < size)
+      {
+        setFunctionModule(xx, yy, distance != 2 && distance != 4);
+      }
+    }
+  }
+}
+
+void QrCode::drawAlignmentPattern(int x, int y)
+{
+  for (int dy = -2; dy <= 2; ++dy)
+  {
+    for (int dx = -2; dx <= 2; ++dx)
+    {
+      setFunctionModule(x + dx, y + dy, (abs(dx) > abs(dy) ? abs(dx) : abs(dy)) != 1);
+    }
+  }
+}
+
+void QrCode::drawFormatBits(Ecc ecc, uint8_t mask)
+{
+  uint32_t data = FORMAT_BITS[static_cast<uint8_t>(ecc)] << 3 | mask;
+  uint32_t remainder = data;
+
+  for (int i = 0; i < 10; ++i)
+  {
+    remainder = (remainder << 1) ^ ((remainder >> 9) * 0x537);
+  }
+
+  uint32_t bits = (data << 10 | remainder) ^ 0x5412;
+
+  for (uint8_t i = 0; i <= 5; ++i)
+  {
+    setFunctionModule(8, i, (bits >> i) & 1);
+  }
+
+  setFunctionModule(8, 7, (bits >> 6) & 1);
+  setFunctionModule(8, 8, (bits >> 7) & 1);
+  setFunctionModule(7, 8, (bits >> 8) & 1);
+
+  for (uint8_t i = 9; i < 15; ++i)
+  {
+    setFunctionModule(14 - i, 8, (bits >> i) & 1);
+  }
+
+  for (uint8_t i = 0; i < 8; ++i)
+  {
+    setFunctionModule(size - 1 - i, 8, (bits >> i) & 1);
+  }
+
+  for (uint8_t i = 8; i < 15; ++i)
+  {
+    setFunctionModule(8, size - 15 + i, (bits >> i) & 1);
+  }
+
+  setFunctionModule(8, size - 8, true); // always dark
+}
+
+void QrCode::drawVersion()
+{
+  if (version < 7)
+  {
+    return;
+  }
+
+  uint32_t remainder = version;
+
+  for (int i = 0; i < 12; ++i)
+  {
+    remainder = (remainder << 1) ^ ((remainder >> 11) * 0x1F25);
+  }
+
+  uint32_t bits = static_cast<uint32_t>(version) << 12 | remainder;
+
+  for (uint8_t i = 0; i < 18; ++i)
+  {
+    bool bit = (bits >> i) & 1;
+    uint8_t a = size - 11 + i % 3;
+    uint8_t b = i / 3;
+
+    setFunctionModule(a, b, bit);
+    setFunctionModule(b, a, bit);
+  }
+}
+
+void QrCode::drawCodewords(const uint8_t *codewords, size_t count)
+{
+  size_t bit = 0;
+
+  // Two-module wide columns, right to left, snaking up and down
+  for (int right = size - 1; right >= 1; right -= 2)
+  {
+    if (right == 6)
+    {
+      right = 5;
+    }
+
+    for (int vertical = 0; vertical < size; ++vertical)
+    {
+      for (int j = 0; j < 2; ++j)
+      {
+        int x = right - j;
+        bool upward = ((right + 1) & 2) == 0;
+        int y = upward ? size - 1 - vertical : vertical;
+
+        if (!isFunction(x, y) && bit < count * 8)
+        {
+          setModule(x, y, (codewords[bit >> 3] >> (7 - (bit & 7))) & 1);
+          ++bit;
+        }
+      }
+    }
+  }
+}
+
+void QrCode::applyMask(uint8_t mask)
+{
+  for (uint8_t y = 0; y < size; ++y)
+  {
+    for (uint8_t x = 0; x < size; ++x)
+    {
+      if (!isFunction(x, y) && maskBit(mask, x, y))
+      {
+        setModule(x, y, !module(x, y));
+      }
+    }
+  }
+}
+
+uint32_t QrCode::penaltyScore() const
+{
+  uint32_t penalty = 0;
+  uint32_t dark = 0;
+
+  for (uint8_t pass = 0; pass < 2; ++pass)
+  {
+    for (uint8_t a = 0; a < size; ++a)
+    {
+      uint8_t runLength = 0;
+      bool runColor = false;
+      uint16_t window = 0; // last 11 modules, for finder-like patterns
+
+      for (uint8_t b = 0; b < size; ++b)
+      {
+        bool color = pass == 0 ? module(b, a) : module(a, b);
+
+        // Runs of five or more of the same color
+        if (b > 0 && color == runColor)
+        {
+          if (++runLength == 5)
+          {
+            penalty += 3;
+          }
+          else if (runLength > 5)
+          {
+            ++penalty;
+          }
+        }
+        else
+        {
+          runColor = color;
+          runLength = 1;
+        }
+
+        // 1:1:3:1:1 with four light modules on either side
+        window = ((window << 1) | color) & 0x7FF;
+        if (b >= 10 && (window == 0x5D0 || window == 0x05D))
+        {
+          penalty += 40;
+        }
+      }
+    }
+  }
+
+  for (uint8_t y = 0; y < size; ++y)
+  {
+    for (uint8_t x = 0; x < size; ++x)
+    {
+      bool color = module(x, y);
+
+      if (color)
+      {
+        ++dark;
+      }
+
+      if (x + 1 < size && y + 1 < size &&
+          color == module(x + 1, y) && color == module(x, y + 1) && color == module(x + 1, y + 1))
+      {
+        penalty += 3;
+      }
+    }
+  }
+
+  uint32_t total = size * size;
+  uint32_t k = (abs(static_cast<int32_t>(dark * 20) - static_cast<int32_t>(total * 10)) + total - 1) / total - 1;
+  penalty += k * 10;
+
+  return penalty;
+}
+
+void QrCode::renderRow(uint8_t moduleY, uint16_t x, uint8_t scale, uint8_t *row, size_t rowBytes) const
+{
+  if (moduleY >= size)
+  {
+    return;
+  }
+
+  for (uint8_t moduleX = 0; moduleX < size;)
+  {
+    if (!module(moduleX, moduleY))
+    {
+      ++moduleX;
+      continue;
+    }
+
+    // Fill whole runs of dark modules at once
+    uint8_t runStart = moduleX;
+    while (moduleX < size && module(moduleX, moduleY))
+    {
+      ++moduleX;
+    }
+
+    fillRowBits(row, rowBytes, x + runStart * scale, (moduleX - runStart) * scale);
+  }
+}
+
+RowSpan QrRowSource::renderRow(uint16_t y, uint8_t *scratch)
+{
+  size_t rowBytes = (columns + 7) / 8;
+
+  if (rowBytes > MAX_ROW_BYTES)
+  {
+    rowBytes = MAX_ROW_BYTES;
+  }
+
+  uint16_t quietZone = QrCode::QUIET_ZONE_MODULES * scale;
+  uint16_t symbolTop = top + quietZone;
+
+  if (y >= symbolTop && y < symbolTop + qr.symbolSize() * scale)
+  {
+    qr.renderRow((y - symbolTop) / scale, left + quietZone, scale, scratch, rowBytes);
+  }
+
+  RowSpan span = {scratch, rowBytes};
+  return span;
+}
@@ -0,0 +1,126 @@
+#include "ResponseDecoder.h"
+
+void ResponseDecoder::receive(const uint8_t *data, size_t length)
+{
+  size_t written = buffer.write(data, length);
+
+  bytesOverflowed += length - written;
+}
+
+ResponseDecoder::FrameCheck ResponseDecoder::checkFrame(size_t offset, size_t available) const
+{
+  if (available < offset + PrinterFraming::HEADER_SIZE)
+  {
+    return FrameCheck::Incomplete;
+  }
+
+  uint8_t code = buffer.peek(offset + 2);
+  uint8_t length = buffer.peek(offset + 3);
+
+  if (available < offset + length + PrinterFraming::OVERHEAD)
+  {
+    return FrameCheck::Incomplete;
+  }
+
+  uint8_t checksum = code ^ length;
+  for (size_t i = 0; i < length; ++i)
+  {
+    checksum ^= buffer.peek(offset + PrinterFraming::HEADER_SIZE + i);
+  }
+
+  size_t checksumIndex = offset + PrinterFraming::HEADER_SIZE + length;
+
+  if (buffer.peek(checksumIndex) != checksum ||
+      buffer.peek(checksumIndex + 1) != PrinterFraming::END_BYTE ||
+      buffer.peek(checksumIndex + 2) != PrinterFraming::END_BYTE)
+  {
+    return FrameCheck::Corrupt;
+  }
+
+  return FrameCheck::Valid;
+}
+
+// Offset of the first complete, valid frame at or after from, or 0 if none
+size_t ResponseDecoder::findValidFrame(size_t from, size_t available) const
+{
+  for (size_t offset = from; offset + 1 < available; ++offset)
+  {
+    if (buffer.peek(offset) == PrinterFraming::START_BYTE && buffer.peek(offset + 1) == PrinterFraming::START_BYTE &&
+        checkFrame(offset, available) == FrameCheck::Valid)
+    {
+      return offset;
+    }
+  }
+
+  return 0;
+}
+
+size_t ResponseDecoder::process(PrinterResponseHandler handler)
+{
+  size_t decoded = 0;
+
+  while (true)
+  {
+    size_t available = buffer.available();
+
+    if (available < 2)
+    {
+      break;
+    }
+
+    // Resynchronize on the next start sequence
+    if (buffer.peek(0) != PrinterFraming::START_BYTE || buffer.peek(1) != PrinterFraming::START_BYTE)
+    {
+      buffer.consume(1);
+      ++bytesDiscarded;
+      continue;
+    }
+
+    FrameCheck check = checkFrame(0, available);
+
+    if (check == FrameCheck::Incomplete)
+    {
+      // A bad length byte would otherwise hold everything behind it until
+      // that many bytes arrive; give up once a good frame follows
+      size_t next = findValidFrame(2, available);
+
+      if (next == 0)
+      {
+        break;
+      }
+
+      ++corruptFrames;
+      buffer.consume(next);
+      bytesDiscarded += next;
+      continue;
+    }
+
+    if (check == FrameCheck::Corrupt)
+    {
+      // Treat the start sequence as noise and look for the next one
+      ++corruptFrames;
+      buffer.consume(1);
+      ++bytesDiscarded;
+      continue;
+    }
+
+    uint8_t code = buffer.peek(2);
+    uint8_t length = buffer.peek(3);
+    const uint8_t *payload = buffer.contiguous(PrinterFraming::HEADER_SIZE, length);
+
+    if (payload == nullptr)
+    {
+      buffer.copyOut(PrinterFraming::HEADER_SIZE, wrappedPayload, length);
+      payload = wrappedPayload;
+    }
+
+    PrinterResponse response = {code, payload, length};
+    handler(response);
+
+    buffer.consume(length + PrinterFraming::OVERHEAD);
+    ++framesDecoded;
+    ++decoded;
+  }
+
+  return decoded;
+}
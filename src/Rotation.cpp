@@ -0,0 +1,151 @@
+#include "Rotation.h"
+
+#include <string.h>
+
+// Eight pixels starting at `column`, which need not be byte aligned; pixels
+// outside the row read as white
+static uint8_t bitsAt(const RowSpan &row, int32_t column)
+{
+  int32_t index = column >> 3;
+  uint8_t shift = column & 7;
+
+  uint8_t high = (index >= 0 && static_cast<size_t>(index) < row.length) ? row.data[index] : 0;
+
+  if (shift == 0)
+  {
+    return high;
+  }
+
+  uint8_t low = (index + 1 >= 0 && static_cast<size_t>(index + 1) < row.length) ? row.data[index + 1] : 0;
+  return (high << shift) | (low >> (8 - shift));
+}
+
+RotatedRowSource::RotatedRowSource(RowSource &source, Rotation rotation)
+    : bandsBuilt(0), source(source), rotation(rotation), bandStart(-1)
+{
+}
+
+uint16_t RotatedRowSource::width() const
+{
+  uint16_t columns = quarterTurn() ? source.height() : source.width();
+  return columns > MAX_WIDTH ? MAX_WIDTH : columns;
+}
+
+uint16_t RotatedRowSource::height() const
+{
+  return quarterTurn() ? source.width() : source.height();
+}
+
+size_t RotatedRowSource::outputRowBytes() const
+{
+  return (width() + 7) / 8;
+}
+
+void RotatedRowSource::buildBand(uint16_t firstRow)
+{
+  size_t rowBytes = outputRowBytes();
+  uint16_t sourceWidth = source.width();
+  uint16_t sourceHeight = quarterTurn() ? width() : source.height();
+  uint16_t bandRows = height() - firstRow < BAND_ROWS ? height() - firstRow : BAND_ROWS;
+
+  // A quarter turn maps the last source row to output pixel 0. Counting
+  // source rows from a padded top keeps every tile on an output byte.
+  uint16_t padding = rowBytes * 8 - sourceHeight;
+  bool clockwise = rotation == Rotation::Quarter;
+
+  for (uint16_t r = 0; r < bandRows; ++r)
+  {
+    memset(band[r], 0, rowBytes);
+  }
+
+  for (size_t group = 0; group < rowBytes; ++group)
+  {
+    RowSpan rows[8];
+
+    for (uint8_t i = 0; i < 8; ++i)
+    {
+      int32_t sourceRow = static_cast<int32_t>(group * 8 + i) - (clockwise ? padding : 0);
+
+      if (sourceRow >= 0 && sourceRow < sourceHeight)
+      {
+        memset(sourceScratch[i], 0, MAX_ROW_BYTES);
+        rows[i] = source.renderRow(sourceRow, sourceScratch[i]);
+      }
+      else
+      {
+        rows[i].data = nullptr;
+        rows[i].length = 0;
+      }
+    }
+
+    // Clockwise, later source rows land further left, so the tile is
+    // stacked bottom-up and the group fills output bytes right to left
+    size_t outputByte = clockwise ? rowBytes - 1 - group : group;
+
+    for (uint16_t tileRow = 0; tileRow < bandRows; tileRow += 8)
+    {
+      uint16_t outputRow = firstRow + tileRow;
+      int32_t column = clockwise ? outputRow : static_cast<int32_t>(sourceWidth) - 8 - outputRow;
+      uint64_t tile = 0;
+
+      for (uint8_t i = 0; i < 8; ++i)
+      {
+        uint8_t bits = rows[i].data != nullptr ? bitsAt(rows[i], column) : 0;
+        tile |= static_cast<uint64_t>(bits) << (8 * (clockwise ? i : 7 - i));
+      }
+
+      tile = transposeBits8x8(tile);
+
+      // Transposed row k is source column `column + k`
+      for (uint8_t k = 0; k < 8; ++k)
+      {
+        uint16_t r = clockwise ? tileRow + k : tileRow + 7 - k;
+
+        if (r < bandRows)
+        {
+          band[r][outputByte] = static_cast<uint8_t>(tile >> (8 * (7 - k)));
+        }
+      }
+    }
+  }
+
+  bandStart = firstRow;
+  ++bandsBuilt;
+}
+
+void RotatedRowSource::renderHalfTurn(uint16_t y, uint8_t *row, size_t rowBytes)
+{
+  memset(sourceScratch[0], 0, MAX_ROW_BYTES);
+  RowSpan sourceRow = source.renderRow(source.height() - 1 - y, sourceScratch[0]);
+  int32_t lastColumn = source.width() - 8;
+
+  for (size_t i = 0; i < rowBytes; ++i)
+  {
+    row[i] = reverseBits8(bitsAt(sourceRow, lastColumn - static_cast<int32_t>(i * 8)));
+  }
+}
+
+RowSpan RotatedRowSource::renderRow(uint16_t y, uint8_t *scratch)
+{
+  size_t rowBytes = outputRowBytes();
+  RowSpan span = {scratch, rowBytes};
+
+  switch (rotation)
+  {
+  case Rotation::None:
+    return source.renderRow(y, scratch);
+
+  case Rotation::Half:
+    renderHalfTurn(y, scratch, rowBytes);
+    return span;
+
+  default:
+    if (bandStart < 0 || y < bandStart || y >= bandStart + BAND_ROWS)
+    {
+      buildBand(y - y % BAND_ROWS);
+    }
+
+    span.data = band[y - bandStart];
+    return span;
+  }
+}
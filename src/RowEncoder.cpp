@@ -0,0 +1,209 @@
+#include "RowEncoder.h"
+
+#include <string.h>
+
+void RowEncoder::begin(uint16_t firstRow)
+{
+  pendingLength = 0;
+  pendingStart = firstRow;
+  pendingRepeat = 0;
+  pendingBlank = false;
+  pendingBlackPixels = 0;
+  rowsEncoded = 0;
+  blankRows = 0;
+  framesEmitted = 0;
+  bitmapFrames = 0;
+  indexedFrames = 0;
+  whitespaceFrames = 0;
+  bytesSaved = 0;
+}
+
+void RowEncoder::addRow(const uint8_t *row, size_t length)
+{
+  if (length > MAX_ROW_BYTES)
+  {
+    length = MAX_ROW_BYTES;
+  }
+
+  uint8_t pixelCounts[SEGMENT_COUNT];
+  uint16_t blackPixels = countBlackPixels(row, length, pixelCounts);
+
+  extendRun(blackPixels, row, length, pixelCounts);
+}
+
+void RowEncoder::addBlankRows(uint16_t count)
+{
+  const uint8_t noPixels[SEGMENT_COUNT] = {};
+
+  for (uint16_t i = 0; i < count; ++i)
+  {
+    extendRun(0, nullptr, 0, noPixels);
+  }
+}
+
+void RowEncoder::extendRun(uint16_t blackPixels, const uint8_t *row, size_t length, const uint8_t (&pixelCounts)[SEGMENT_COUNT])
+{
+  bool blank = blackPixels == 0;
+
+  ++rowsEncoded;
+
+  if (blank)
+  {
+    ++blankRows;
+  }
+
+  if (pendingRepeat > 0 && pendingRepeat < MAX_REPEAT && blank == pendingBlank &&
+      (blank || (length == pendingLength && memcmp(row, pendingRow, length) == 0)))
+  {
+    ++pendingRepeat;
+    return;
+  }
+
+  flush();
+
+  if (!blank)
+  {
+    memcpy(pendingRow, row, length);
+    memcpy(pendingPixelCounts, pixelCounts, SEGMENT_COUNT);
+  }
+
+  pendingLength = blank ? 0 : length;
+  pendingBlackPixels = blackPixels;
+  pendingBlank = blank;
+  pendingRepeat = 1;
+}
+
+void RowEncoder::finish()
+{
+  flush();
+}
+
+void RowEncoder::flush()
+{
+  if (pendingRepeat == 0)
+  {
+    return;
+  }
+
+  PrinterFrame command;
+
+  if (pendingBlank)
+  {
+    const uint8_t body[] = {
+        static_cast<uint8_t>(pendingStart >> 8), static_cast<uint8_t>(pendingStart),
+        pendingRepeat};
+
+    command.begin(PrinterCommands::PRINT_WHITESPACE);
+    command.append(body, sizeof(body));
+    command.finish();
+
+    bytesSaved += ROW_HEADER_SIZE + PRINT_HEAD_BYTES - sizeof(body);
+    ++whitespaceFrames;
+  }
+  else
+  {
+    const uint8_t positionSeq[] = {
+        static_cast<uint8_t>(pendingStart >> 8), static_cast<uint8_t>(pendingStart),
+        pendingPixelCounts[0], pendingPixelCounts[1], pendingPixelCounts[2],
+        pendingRepeat};
+
+    size_t bitmapSize = pendingLength;
+    size_t indexedSize = pendingBlackPixels * sizeof(uint16_t);
+
+    if (indexedSize < bitmapSize)
+    {
+      command.begin(PrinterCommands::PRINT_LINE_INDEXED);
+      command.append(positionSeq, sizeof(positionSeq));
+      appendPixelIndexes(command);
+
+      bytesSaved += bitmapSize - indexedSize;
+      ++indexedFrames;
+    }
+    else
+    {
+      command.begin(PrinterCommands::PRINT_LINE);
+      command.append(positionSeq, sizeof(positionSeq));
+      command.append(pendingRow, pendingLength);
+
+      ++bitmapFrames;
+    }
+
+    command.finish();
+  }
+
+  sink(command, context);
+  ++framesEmitted;
+
+  pendingStart += pendingRepeat;
+  pendingRepeat = 0;
+}
+
+void RowEncoder::appendPixelIndexes(PrinterFrame &command) const
+{
+  for (size_t i = 0; i < pendingLength; ++i)
+  {
+    uint8_t bits = pendingRow[i];
+
+    // Pixels are stored most significant bit first
+    while (bits != 0)
+    {
+      uint8_t bit = 7 - (31 - __builtin_clz(bits));
+      uint16_t position = i * 8 + bit;
+
+      command.push(static_cast<uint8_t>(position >> 8));
+      command.push(static_cast<uint8_t>(position));
+
+      bits &= ~(0x80 >> bit);
+    }
+  }
+}
+
+uint16_t RowEncoder::countBlackPixels(const uint8_t *row, size_t length, uint8_t (&pixelCounts)[SEGMENT_COUNT])
+{
+  uint16_t segments[SEGMENT_COUNT] = {};
+  uint16_t total = 0;
+  size_t i = 0;
+
+  // Segments are whole words wide, so every word lands in exactly one
+  for (; i + sizeof(uint32_t) <= length; i += sizeof(uint32_t))
+  {
+    uint32_t word;
+    memcpy(&word, row + i, sizeof(word));
+
+    uint16_t bits = __builtin_popcount(word);
+    total += bits;
+
+    if (i < PRINT_HEAD_BYTES)
+    {
+      segments[i / SEGMENT_BYTES] += bits;
+    }
+  }
+
+  for (; i < length; ++i)
+  {
+    uint16_t bits = __builtin_popcount(row[i]);
+    total += bits;
+
+    if (i < PRINT_HEAD_BYTES)
+    {
+      segments[i / SEGMENT_BYTES] += bits;
+    }
+  }
+
+  if (length <= PRINT_HEAD_BYTES)
+  {
+    for (size_t segment = 0; segment < SEGMENT_COUNT; ++segment)
+    {
+      pixelCounts[segment] = static_cast<uint8_t>(segments[segment]);
+    }
+  }
+  else
+  {
+    // Rows wider than the head only carry the total
+    pixelCounts[0] = 0;
+    pixelCounts[1] = static_cast<uint8_t>(total >> 8);
+    pixelCounts[2] = static_cast<uint8_t>(total);
+  }
+
+  return total;
+}
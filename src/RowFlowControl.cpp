@@ -0,0 +1,46 @@
+#include "RowFlowControl.h"
+
+#include "PrinterProtocol.h"
+
+void RowFlowControl::reset(uint32_t now)
+{
+  first = 0;
+  count = 0;
+  lastProgressAt = now;
+}
+
+bool RowFlowControl::stalled(uint32_t now) const
+{
+  return !hasCredit() && now - lastProgressAt >= STALL_TIMEOUT_MS;
+}
+
+void RowFlowControl::onSent(uint16_t lastRow)
+{
+  outstandingRows[(first + count) % WINDOW] = lastRow;
+  ++count;
+}
+
+void RowFlowControl::onSynchronized(uint32_t now)
+{
+  reset(now);
+}
+
+void RowFlowControl::onPrinterProgress(uint16_t row, uint32_t now)
+{
+  while (count > 0 && outstandingRows[first] <= row)
+  {
+    first = (first + 1) % WINDOW;
+    --count;
+  }
+
+  lastProgressAt = now;
+}
+
+uint16_t RowFlowControl::frameLastRow(const uint8_t *frame)
+{
+  const uint8_t *body = frame + PrinterFraming::HEADER_SIZE;
+  uint16_t startRow = (body[0] << 8) | body[1];
+  uint8_t repeat = frame[2] == PrinterCommands::PRINT_WHITESPACE ? body[2] : body[5];
+
+  return startRow + (repeat > 0 ? repeat - 1 : 0);
+}
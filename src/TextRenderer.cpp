@@ -0,0 +1,144 @@
+#include "TextRenderer.h"
+
+#include <string.h>
+
+TextRenderer::TextRenderer(const BitmapFont &font)
+    : cacheHits(0), cacheMisses(0), font(font),
+      glyphHeight(font.height < MAX_GLYPH_HEIGHT ? font.height : MAX_GLYPH_HEIGHT), useClock(0)
+{
+  for (size_t i = 0; i < GLYPH_CACHE_SIZE; ++i)
+  {
+    cache[i].scale = 0; // empty slot
+    cache[i].lastUsed = 0;
+  }
+}
+
+uint8_t TextRenderer::clampScale(uint8_t scale) const
+{
+  if (scale == 0)
+  {
+    return 1;
+  }
+
+  return scale > maxScale() ? maxScale() : scale;
+}
+
+uint16_t TextRenderer::textWidth(const char *text, uint8_t scale) const
+{
+  return strlen(text) * (font.width + 1) * clampScale(scale);
+}
+
+const TextRenderer::CachedGlyph &TextRenderer::glyph(char character, uint8_t scale)
+{
+  size_t victim = 0;
+
+  for (size_t i = 0; i < GLYPH_CACHE_SIZE; ++i)
+  {
+    if (cache[i].scale == scale && cache[i].character == character)
+    {
+      ++cacheHits;
+      cache[i].lastUsed = ++useClock;
+      return cache[i];
+    }
+
+    if (cache[i].lastUsed < cache[victim].lastUsed)
+    {
+      victim = i;
+    }
+  }
+
+  ++cacheMisses;
+  decode(cache[victim], character, scale);
+  cache[victim].lastUsed = ++useClock;
+  return cache[victim];
+}
+
+void TextRenderer::decode(CachedGlyph &entry, char character, uint8_t scale) const
+{
+  entry.character = character;
+  entry.scale = scale;
+  memset(entry.rows, 0, sizeof(entry.rows));
+
+  if (character < font.firstCharacter || character > font.lastCharacter)
+  {
+    return; // unknown characters render as blanks
+  }
+
+  const uint8_t *columns = font.columns + (character - font.firstCharacter) * font.width;
+  uint32_t pixelMask = (scale >= 32 ? 0xFFFFFFFFu : (1u << scale) - 1) << (32 - scale);
+
+  // Transpose the column-major glyph into left-aligned row masks, widening
+  // every font pixel to `scale` output pixels on the way
+  for (uint8_t column = 0; column < font.width; ++column)
+  {
+    for (uint8_t y = 0; y < glyphHeight; ++y)
+    {
+      if (columns[column] & (1 << y))
+      {
+        entry.rows[y] |= pixelMask >> (column * scale);
+      }
+    }
+  }
+}
+
+void TextRenderer::renderScanline(const char *text, uint16_t x, uint16_t line, uint8_t scale, uint8_t *row, size_t rowBytes)
+{
+  scale = clampScale(scale);
+
+  uint16_t fontRow = line / scale;
+  uint16_t advance = (font.width + 1) * scale;
+
+  if (fontRow >= glyphHeight)
+  {
+    return;
+  }
+
+  for (const char *character = text; *character != '\0'; ++character, x += advance)
+  {
+    size_t firstByte = x / 8;
+
+    if (firstByte >= rowBytes)
+    {
+      break;
+    }
+
+    uint32_t mask = glyph(*character, scale).rows[fontRow];
+
+    if (mask == 0)
+    {
+      continue;
+    }
+
+    // Shift the 32-bit mask to the pixel offset and OR it in a byte at a
+    // time; it spans at most five bytes
+    uint64_t bits = static_cast<uint64_t>(mask) << (32 - (x & 7));
+
+    for (size_t i = 0; i < 5 && firstByte + i < rowBytes; ++i)
+    {
+      row[firstByte + i] |= static_cast<uint8_t>(bits >> (56 - i * 8));
+    }
+  }
+}
+
+RowSpan TextRowSource::renderRow(uint16_t y, uint8_t *scratch)
+{
+  size_t rowBytes = (columns + 7) / 8;
+
+  if (rowBytes > MAX_ROW_BYTES)
+  {
+    rowBytes = MAX_ROW_BYTES;
+  }
+
+  for (size_t i = 0; i < lineCount; ++i)
+  {
+    const TextLine &line = lines[i];
+
+    if (y >= line.y && y < line.y + renderer.textHeight(line.scale))
+    {
+      renderer.renderScanline(line.text, line.x, y - line.y, line.scale, scratch, rowBytes);
+    }
+  }
+
+  RowSpan span = {scratch, rowBytes};
+  return span;
+}
@@ -1,346 +1,1686 @@
-#include <vector>
-#include <queue>
+#include <atomic>
 
 #include <Arduino.h>
 
 #include <BLEDevice.h>
 #include <BLEServer.h>
+#include <Preferences.h>
+#include <esp_gap_ble_api.h>
+#include <esp_gattc_api.h>
+
+#include "Benchmark.h"
+#include "CommandTracker.h"
+#include "ContentHash.h"
+#include "FrameCache.h"
+#include "FrameQueue.h"
+#include "Framebuffer.h"
+#include "PrinterFrame.h"
+#include "PrinterState.h"
+#include "ResponseDecoder.h"
+#include "RowEncoder.h"
+#include "RowFlowControl.h"
+#include "RowSource.h"
+#include "WriteBatch.h"
 
 #define PRINTER_DEVICE_NAME "B1-G121131120"
+#define LABEL_WIDTH 384
+#define LABEL_HEIGHT 240
+#define LABEL_COPIES 1
+#define PRINT_DENSITY 3
+#define PRINT_QUEUE_DEPTH 8
+#define PRINT_QUEUE_BYTES 2048
+#define PREFERRED_MTU 517
+#define PREFERRED_DATA_LENGTH 251
+
+// Set to 0 to send every row as an acknowledged write, as the client used to
+#ifndef NIIMBOT_STREAM_ROWS
+#define NIIMBOT_STREAM_ROWS 1
+#endif
+
+// Set to 0 to render rows on the loop task, between writes
+#ifndef NIIMBOT_RENDER_TASK
+#define NIIMBOT_RENDER_TASK 1
+#endif
+
+// Set to 1 to hex-dump frames on Serial; slow enough to throttle printing
+#ifndef NIIMBOT_LOG_FRAMES
+#define NIIMBOT_LOG_FRAMES 0
+#endif
+
+// loop() and the BLE writes run on core 1, rendering gets core 0
+#define RENDER_TASK_CORE 0
+#define RENDER_TASK_STACK_SIZE 8192
+#define RENDER_TASK_PRIORITY 1
 
 static BLEUUID niimbotB1ServiceUUID("E7810A71-73AE-499D-8C15-FAA9AEF0C3F2");
 static BLEUUID printerCommunicationCharacteristicUUID("BEF8D6C9-9C21-4C9E-B632-BD58C1009F9F");
 
 static BLEAddress *printerDeviceAddress = nullptr;
+static BLEClient *printerClient = nullptr;
 static BLERemoteCharacteristic *printerCommunicationCharacteristic = nullptr;
 
-static boolean attemptConnectionToPrinter = false;
+// Attribute handles of the communication characteristic, with the address of
+// the printer they were discovered on. A reconnect to the same printer writes
+// and subscribes through them instead of discovering the service again.
+struct GattHandles
+{
+  esp_bd_addr_t address;
+  uint16_t serviceStart;
+  uint16_t serviceEnd;
+  uint16_t characteristic;
+  uint16_t clientConfiguration;
+};
+
+static GattHandles linkHandles = {};
+static GattHandles savedGattHandles = {};
+static boolean gattHandlesSaved = false;
+
+// While set, writes and notifications bypass the library's characteristic
+// objects and go straight through the GATT client API on linkHandles
+static volatile boolean linkOnSavedHandles = false;
+static esp_gatt_if_t linkInterface = 0;
+static uint16_t linkConnection = 0;
+static SemaphoreHandle_t linkWriteDone = nullptr;
+
+// Given once the stack has finished service discovery for the connection;
+// before that its attribute table cannot confirm the saved handles
+static SemaphoreHandle_t linkServicesDiscovered = nullptr;
+static const uint32_t SERVICE_DISCOVERY_TIMEOUT_MS = 3000;
+
+// Set from BLE stack callbacks, picked up by the session in loop()
+static volatile boolean attemptConnectionToPrinter = false;
+static volatile boolean scanFinished = false;
+static volatile boolean connectionLost = false;
+
 static boolean connectedToPrinter = false;
 static boolean printing = false;
+static boolean endingPrint = false;
+
+static const uint32_t COMMAND_TIMEOUT_MS = 2000;
+static const boolean STREAM_ROWS = NIIMBOT_STREAM_ROWS;
+
+// Filled by the renderer, drained by the sender; single producer, single
+// consumer, so the two sides never take a lock
+static FrameQueue<PRINT_QUEUE_BYTES> printerCommands;
+
+// Set by the sender when a stream starts, cleared by the renderer once the
+// last frame of the stream has been queued
+static std::atomic<bool> producingFrames(false);
+
+// Set by the sender to abandon the stream, the renderer drops it on its next
+// refill
+static std::atomic<bool> abandonStream(false);
+static TaskHandle_t renderTask = nullptr;
+
+static ResponseDecoder responseDecoder;
+static PrinterState printerState;
+static FrameCache frameCache;
+static CommandTracker commandTracker;
+static RowFlowControl rowFlowControl;
+
+struct RowStreamStats
+{
+  uint32_t startedAt;
+  uint32_t frames;
+  uint32_t rows;
+  uint32_t synchronizedWrites;
+};
+
+static RowStreamStats rowStreamStats = {};
 
-typedef std::vector<uint8_t> PrinterCommand;
+struct WriteStats
+{
+  uint32_t writes;
+  uint32_t bytes;
+  uint32_t microseconds;
+};
 
-std::queue<PrinterCommand> printerCommands;
+static WriteStats writeStats = {};
+static WriteBatch rowBatch;
+
+static bool deadlineReached(uint32_t now, uint32_t deadline)
+{
+  return static_cast<int32_t>(now - deadline) >= 0;
+}
 
-namespace PrinterCommands
+void printHexData(const uint8_t *data, size_t length)
 {
-  const uint8_t CALIBRATE_LABEL_GAP = 0x8E;
-  const uint8_t HEARTBEAT = 0xDC;
-  const uint8_t GET_PRINT_STATUS = 0xA3;
-  const uint8_t GET_LABEL_RFID = 0x1A;
-  const uint8_t SET_LABEL_TYPE = 0x23;
-  const uint8_t SET_PRINT_DENSITY = 0x21;
-  const uint8_t START_LABEL_PRINT_DATA_EXCHANGE = 0x01;
-  const uint8_t SET_PRINT_DIMENSIONS = 0x13;
-  const uint8_t END_LABEL_PRINT_DATA_EXCHANGE = 0xE3;
-  const uint8_t END_PRINT = 0xF3;
-  const uint8_t PRINT_LINE = 0x85;
-  const uint8_t PRINT_WHITESPACE = 0x84;
+  for (int i = 0; i < length; i++)
+  {
+    uint8_t chunk = *(data + i);
+
+    Serial.print(" ");
+
+    if (chunk < 0x0f)
+    {
+      Serial.print(0);
+    }
+
+    Serial.print(chunk, HEX);
+  }
 }
 
-PrinterCommand calculateXor(const PrinterCommand &command)
+// Like the library's writeValue, waits until the stack has taken the write
+bool writeAttribute(uint16_t handle, const uint8_t *data, size_t length, bool withResponse)
 {
-  PrinterCommand result;
+  esp_gatt_write_type_t type = withResponse ? ESP_GATT_WRITE_TYPE_RSP : ESP_GATT_WRITE_TYPE_NO_RSP;
+  uint8_t *value = const_cast<uint8_t *>(data);
+
+  // Drop a completion left over from a write that timed out
+  xSemaphoreTake(linkWriteDone, 0);
+
+  esp_err_t result = handle == linkHandles.clientConfiguration
+                         ? esp_ble_gattc_write_char_descr(linkInterface, linkConnection, handle, length, value, type, ESP_GATT_AUTH_REQ_NONE)
+                         : esp_ble_gattc_write_char(linkInterface, linkConnection, handle, length, value, type, ESP_GATT_AUTH_REQ_NONE);
 
-  if (command.empty())
+  return result == ESP_OK && xSemaphoreTake(linkWriteDone, pdMS_TO_TICKS(COMMAND_TIMEOUT_MS)) == pdTRUE;
+}
+
+void sendCommand(const uint8_t *data, size_t length, bool withResponse = true)
+{
+  if (!connectedToPrinter)
   {
-    return result; // return an empty result in case of empty input
+    return;
   }
 
-  uint8_t xor_value = command[0]; // Start with the first element
-  for (size_t i = 1; i < command.size(); ++i)
+  unsigned long start = micros();
+
+  if (linkOnSavedHandles)
+  {
+    writeAttribute(linkHandles.characteristic, data, length, withResponse);
+  }
+  else
   {
-    xor_value ^= command[i]; // Apply the XOR operation with each subsequent element
+    // The BLE library takes a mutable pointer but never writes through it
+    printerCommunicationCharacteristic->writeValue(const_cast<uint8_t *>(data), length, withResponse);
   }
 
-  result.push_back(xor_value); // push final XOR value to the result
-  return result;
+  writeStats.microseconds += micros() - start;
+  writeStats.bytes += length;
+  ++writeStats.writes;
 }
 
-PrinterCommand createPacket(const PrinterCommand &bodySeq)
+void sendCommand(const PrinterFrame &frame)
 {
-  PrinterCommand startSeq = {0x55, 0x55};
-  PrinterCommand checksumSeq = calculateXor(bodySeq);
-  PrinterCommand endSeq = {0xAA, 0xAA};
+  sendCommand(frame.data(), frame.size());
+}
 
-  PrinterCommand command = {};
+template <size_t FrameLength>
+void sendCommand(const std::array<uint8_t, FrameLength> &frame)
+{
+  sendCommand(frame.data(), frame.size());
+}
 
-  command.insert(command.end(), startSeq.begin(), startSeq.end());
-  command.insert(command.end(), bodySeq.begin(), bodySeq.end());
-  command.insert(command.end(), checksumSeq.begin(), checksumSeq.end());
-  command.insert(command.end(), endSeq.begin(), endSeq.end());
+bool sendRequest(const uint8_t *data, size_t length, CommandCallback callback, void *context)
+{
+  if (!commandTracker.track(data[2], callback, context, millis(), COMMAND_TIMEOUT_MS))
+  {
+    Serial.printf("Too many commands in flight, 0x%02X not sent\n", data[2]);
+    return false;
+  }
 
-  return command;
+  sendCommand(data, length);
+  return true;
 }
 
-PrinterCommand createCommand(uint8_t commandCode, const PrinterCommand &bodySeq)
+bool sendRequest(const PrinterFrame &frame, CommandCallback callback, void *context)
 {
-  PrinterCommand commandCodeSeq = {commandCode};
-  PrinterCommand dataSizeSeq = {static_cast<uint8_t>(bodySeq.size())};
-
-  PrinterCommand command = {};
+  if (!frame.valid())
+  {
+    Serial.printf("Command 0x%02X body too long, not sent\n", frame.data()[2]);
+    return false;
+  }
 
-  command.insert(command.end(), commandCodeSeq.begin(), commandCodeSeq.end());
-  command.insert(command.end(), dataSizeSeq.begin(), dataSizeSeq.end());
-  command.insert(command.end(), bodySeq.begin(), bodySeq.end());
+  return sendRequest(frame.data(), frame.size(), callback, context);
+}
 
-  return createPacket(command);
+template <size_t FrameLength>
+bool sendRequest(const std::array<uint8_t, FrameLength> &frame, CommandCallback callback, void *context)
+{
+  return sendRequest(frame.data(), frame.size(), callback, context);
 }
 
-void printHexData(uint8_t *data, size_t length)
+static void updatePrinterState(const PrinterResponse &response)
 {
-  for (int i = 0; i < length; i++)
+  PrinterState previous = printerState;
+
+  if (!printerState.applyHeartbeat(response.payload, response.length, millis()))
   {
-    uint8_t chunk = *(data + i);
+    return;
+  }
 
-    Serial.print(" ");
+  if (previous.lidClosed.value != printerState.lidClosed.value ||
+      previous.paperPresent.value != printerState.paperPresent.value ||
+      previous.batteryLevel.value != printerState.batteryLevel.value ||
+      !previous.lidClosed.known)
+  {
+    Serial.printf("Printer: lid %s, %s, battery %u\n",
+                  printerState.lidClosed.value ? "closed" : "open",
+                  printerState.paperPresent.value ? "labels loaded" : "no labels",
+                  printerState.batteryLevel.value);
+  }
+}
 
-    if (chunk < 0x0f)
-    {
-      Serial.print(0);
-    }
+static void handlePrinterResponse(const PrinterResponse &response)
+{
+#if NIIMBOT_LOG_FRAMES
+  Serial.print("<- ");
+  Serial.print(response.code, HEX);
+  Serial.print(":");
+  printHexData(response.payload, response.length);
+  Serial.println();
+#endif
 
-    Serial.print(chunk, HEX);
+  if (response.code == PrinterResponses::PRINTER_CHECK_LINE && response.length >= 2)
+  {
+    rowFlowControl.onPrinterProgress((response.payload[0] << 8) | response.payload[1], millis());
+    return;
+  }
+
+  // Solicited or not, every heartbeat and error refreshes the cached state
+  if (isResponseTo(PrinterCommands::HEARTBEAT, response.code))
+  {
+    updatePrinterState(response);
+  }
+  else if (response.code == PrinterResponses::PRINT_ERROR && response.length >= 1)
+  {
+    printerState.applyError(response.payload[0], millis());
+    Serial.printf("Printer error %u\n", response.payload[0]);
   }
+
+  commandTracker.resolve(response);
 }
 
-void sendCommand(PrinterCommand &command)
+void pumpPrinterResponses()
 {
-  printerCommunicationCharacteristic->writeValue(command.data(), command.size(), true);
+  responseDecoder.process(handlePrinterResponse);
+  commandTracker.expire(millis());
 }
 
-void sendCalibrateLabelGapSignal()
+void queueCommand(const uint8_t *data, size_t length)
 {
-  PrinterCommand command = createCommand(PrinterCommands::CALIBRATE_LABEL_GAP, {0x01});
-  sendCommand(command);
+  // The queue is only refilled while a whole frame fits, so this never drops
+  if (!printerCommands.push(data, length))
+  {
+    Serial.println("Print queue full, frame dropped");
+  }
 }
 
-void sendHeartbeatSignal()
+void queueCommand(const PrinterFrame &frame)
 {
-  PrinterCommand command = createCommand(PrinterCommands::HEARTBEAT, {0x04});
+  if (!frame.valid())
+  {
+    Serial.printf("Command 0x%02X body too long, frame dropped\n", frame.data()[2]);
+    return;
+  }
+
+  queueCommand(frame.data(), frame.size());
+}
 
-  sendCommand(command);
+bool sendCalibrateLabelGapSignal(CommandCallback callback = nullptr, void *context = nullptr)
+{
+  return sendRequest(PrinterFrames::CALIBRATE_LABEL_GAP, callback, context);
 }
 
-void sendGetPrintStatus()
+bool sendHeartbeatSignal(CommandCallback callback = nullptr, void *context = nullptr)
 {
-  PrinterCommand command = createCommand(PrinterCommands::GET_PRINT_STATUS, {0x01});
+  return sendRequest(PrinterFrames::HEARTBEAT, callback, context);
+}
 
-  sendCommand(command);
+bool sendGetPrintStatus(CommandCallback callback = nullptr, void *context = nullptr)
+{
+  return sendRequest(PrinterFrames::GET_PRINT_STATUS, callback, context);
 }
 
-void sendGetRFID()
+bool sendGetRFID(CommandCallback callback = nullptr, void *context = nullptr)
 {
-  PrinterCommand command = createCommand(PrinterCommands::GET_LABEL_RFID, {0x01});
+  return sendRequest(PrinterFrames::GET_LABEL_RFID, callback, context);
+}
 
-  sendCommand(command);
+bool sendSetLabelType(CommandCallback callback = nullptr, void *context = nullptr)
+{
+  return sendRequest(PrinterFrames::SET_LABEL_TYPE, callback, context);
 }
 
-void sendSetLabelType()
+bool sendSetDensity(uint8_t density, CommandCallback callback = nullptr, void *context = nullptr)
 {
-  PrinterCommand command = createCommand(PrinterCommands::SET_LABEL_TYPE, {0x01});
+  const uint8_t body[] = {density};
+  PrinterFrame command(PrinterCommands::SET_PRINT_DENSITY, body, sizeof(body));
 
-  sendCommand(command);
+  return sendRequest(command, callback, context);
 }
 
-void sendSetDensity(uint8_t density)
+bool sendStartLabelPrintDataExchange(uint16_t totalPages, CommandCallback callback = nullptr, void *context = nullptr)
 {
-  PrinterCommand command = createCommand(PrinterCommands::SET_PRINT_DENSITY, {density});
+  const uint8_t body[] = {static_cast<uint8_t>(totalPages >> 8), static_cast<uint8_t>(totalPages)};
+  PrinterFrame command(PrinterCommands::START_LABEL_PRINT_DATA_EXCHANGE, body, sizeof(body));
+  rowStreamStats = {};
+  writeStats = {};
 
-  sendCommand(command);
+  return sendRequest(command, callback, context);
 }
 
-void sendStartLabelPrintDataExchange()
+bool sendPrintDimensions(uint16_t rows, uint16_t columns, uint16_t copies, CommandCallback callback = nullptr, void *context = nullptr)
 {
-  PrinterCommand command = createCommand(PrinterCommands::START_LABEL_PRINT_DATA_EXCHANGE, {0x00, 0x01});
-  printing = true;
+  const uint8_t body[] = {
+      static_cast<uint8_t>(rows >> 8), static_cast<uint8_t>(rows),
+      static_cast<uint8_t>(columns >> 8), static_cast<uint8_t>(columns),
+      static_cast<uint8_t>(copies >> 8), static_cast<uint8_t>(copies)};
+  PrinterFrame command(PrinterCommands::SET_PRINT_DIMENSIONS, body, sizeof(body));
+
+  return sendRequest(command, callback, context);
+}
 
-  sendCommand(command);
+bool sendEndLabelPrintDataExchange(CommandCallback callback = nullptr, void *context = nullptr)
+{
+  return sendRequest(PrinterFrames::END_LABEL_PRINT_DATA_EXCHANGE, callback, context);
 }
 
-void sendPrintDimensions(uint8_t width, uint8_t height)
+bool sendEndPrint(CommandCallback callback = nullptr, void *context = nullptr)
 {
-  PrinterCommand command = createCommand(PrinterCommands::SET_PRINT_DIMENSIONS, {0x00, width, 0x01, height, 0x00, 0x01});
+  printing = false;
+  endingPrint = false;
 
-  sendCommand(command);
+  return sendRequest(PrinterFrames::END_PRINT, callback, context);
 }
 
-void sendEndLabelPrintDataExchange()
+static void queueEncodedFrame(const PrinterFrame &frame, void *context)
 {
-  PrinterCommand command = createCommand(PrinterCommands::END_LABEL_PRINT_DATA_EXCHANGE, {0x01});
+  queueCommand(frame);
 
-  sendCommand(command);
+  // A label missing a frame is not worth replaying
+  if (!frame.valid())
+  {
+    frameCache.abortRecording();
+  }
+  else if (frameCache.recording())
+  {
+    frameCache.record(frame.data(), frame.size());
+  }
 }
 
-void sendEndPrint()
+static RowEncoder rowEncoder(queueEncodedFrame, nullptr);
+
+// Rows are pulled from the active source only as the sender drains the queue
+static RowSource *activeRowSource = nullptr;
+static uint16_t nextSourceRow = 0;
+static uint8_t sourceRowScratch[RowSource::MAX_ROW_BYTES];
+
+// Demo artwork, 48 bytes per row starting at row DEMO_ARTWORK_TOP
+static const uint16_t DEMO_ARTWORK_TOP = 32;
+static const uint8_t DEMO_ARTWORK[][48] = {
+    {0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111},
+    {0b00000000, 0b11100000, 0b00011111, 0b00000000, 0b00000001, 0b10000000, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11110000, 0b00001111, 0b00000000, 0b00011111, 0b11111000, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111},
+    {0b00000000, 0b11110000, 0b00011111, 0b00000000, 0b00000011, 0b11000000, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11110000, 0b00001111, 0b00000000, 0b01111111, 0b11111110, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111},
+    {0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00001111, 0b11110000, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11110000, 0b00001111, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111},
+    {0b00000000, 0b11111100, 0b00011111, 0b00000000, 0b00001100, 0b00110000, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00001111, 0b00000000, 0b11111000, 0b11111110, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111000, 0b00111110, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111},
+    {0b00000000, 0b11111110, 0b00011111, 0b00000000, 0b00011100, 0b00111000, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00001111, 0b00000000, 0b11111000, 0b00111100, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00000000, 0b00000000, 0b11111000, 0b00111100, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111},
+    {0b00000000, 0b11111111, 0b00011111, 0b00000000, 0b00111000, 0b00011100, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00001111, 0b00000000, 0b11111000, 0b00111100, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00000000, 0b00000000, 0b11111000, 0b00111100, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111},
+    {0b00000000, 0b11111111, 0b10011111, 0b00000000, 0b00111000, 0b00011100, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00001111, 0b00000000, 0b11111000, 0b01111100, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00000000, 0b00000000, 0b11111000, 0b01111100, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111},
+    {0b00000000, 0b11111011, 0b11111111, 0b00000000, 0b00111001, 0b10011100, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00001111, 0b00000000, 0b11111111, 0b11110000, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11111111, 0b11100000, 0b00000000, 0b11111111, 0b11110000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111},
+    {0b00000000, 0b11111001, 0b11111111, 0b00000000, 0b00111111, 0b11111100, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00001111, 0b00000000, 0b11111111, 0b11110000, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11111111, 0b11100000, 0b00000000, 0b11111111, 0b11110000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111},
+    {0b00000000, 0b11111000, 0b11111111, 0b00000000, 0b01111111, 0b11111110, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00001111, 0b00000000, 0b11111111, 0b11110000, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11111111, 0b11100000, 0b00000000, 0b11111111, 0b11110000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111},
+    {0b00000000, 0b11111000, 0b01111111, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00001111, 0b00000000, 0b11111000, 0b01111100, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11111111, 0b11100000, 0b00000000, 0b11111000, 0b01111100, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111},
+    {0b00000000, 0b11111000, 0b00111111, 0b00000000, 0b11111100, 0b00111111, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00001111, 0b00000000, 0b11111000, 0b00111100, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00000000, 0b00000000, 0b11111000, 0b00111100, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111},
+    {0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00001111, 0b00000000, 0b11111000, 0b00011110, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00000000, 0b00000000, 0b11111000, 0b00011110, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111},
+    {0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00000000, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111},
+    {0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11111100, 0b00111111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00000000, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111},
+    {0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111},
+    {0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111},
+    {0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111},
+};
+
+static uint8_t labelStorage[Framebuffer::storageSizeFor(LABEL_WIDTH, LABEL_HEIGHT)];
+static Framebuffer label(LABEL_WIDTH, LABEL_HEIGHT, labelStorage);
+static FramebufferRowSource labelRowSource(label);
+
+void drawDemoLabel(Framebuffer &target)
 {
-  PrinterCommand command = createCommand(PrinterCommands::END_PRINT, {0x01});
-  printing = false;
+  for (size_t i = 0; i < sizeof(DEMO_ARTWORK) / sizeof(DEMO_ARTWORK[0]); ++i)
+  {
+    target.setRow(DEMO_ARTWORK_TOP + i, DEMO_ARTWORK[i], sizeof(DEMO_ARTWORK[i]));
+  }
+}
+
+void requestFrames();
 
-  sendCommand(command);
+void startProducing()
+{
+  abandonStream.store(false, std::memory_order_relaxed);
+  producingFrames.store(true, std::memory_order_release);
+  requestFrames();
 }
 
-void queuePrintWhitespace(uint8_t startPosition, uint8_t thickness)
+// Sender side, for a stream the printer will never take
+void stopProducing()
 {
-  printerCommands.push(
-      createCommand(PrinterCommands::PRINT_WHITESPACE, {0x00, startPosition, thickness}));
+  if (producingFrames.load(std::memory_order_acquire))
+  {
+    abandonStream.store(true, std::memory_order_release);
+    requestFrames();
+  }
 }
 
-void queuePrintLine(uint8_t startPosition, uint8_t thickness, const PrinterCommand &bodySeq)
+void startRowStream(RowSource &source)
 {
-  PrinterCommand positionSeq = {
-      0x00, startPosition,
-      0x80, 0x32,
-      0x00, thickness};
+  activeRowSource = &source;
+  nextSourceRow = 0;
+  rowEncoder.begin(0);
+  printing = true;
 
-  PrinterCommand command = {};
+  startProducing();
+}
 
-  command.insert(command.end(), positionSeq.begin(), positionSeq.end());
-  command.insert(command.end(), bodySeq.begin(), bodySeq.end());
+boolean printQueueHasRoom()
+{
+  return printerCommands.frameCount() < PRINT_QUEUE_DEPTH && printerCommands.fits(PrinterFraming::MAX_FRAME_SIZE);
+}
 
-  printerCommands.push(
-      createCommand(PrinterCommands::PRINT_LINE, command));
+boolean rowStreamActive()
+{
+  return producingFrames.load(std::memory_order_acquire);
 }
 
-void queuePrint()
+void renderRemainingRows(uint16_t firstRow);
+
+// On a cache hit the stored frames go out as they are, nothing is rendered.
+// nextSourceRow follows the replay, so damaged frames can be rendered anew
+// from the first row they should have carried.
+void refillFromFrameCache()
 {
-  // Print data
-  queuePrintWhitespace(0, 32);
-  queuePrintLine(32, 1, {0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111});
-  queuePrintLine(33, 1, {0b00000000, 0b11100000, 0b00011111, 0b00000000, 0b00000001, 0b10000000, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11110000, 0b00001111, 0b00000000, 0b00011111, 0b11111000, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111});
-  queuePrintLine(34, 1, {0b00000000, 0b11110000, 0b00011111, 0b00000000, 0b00000011, 0b11000000, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11110000, 0b00001111, 0b00000000, 0b01111111, 0b11111110, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111});
-  queuePrintLine(35, 1, {0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00001111, 0b11110000, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11110000, 0b00001111, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111});
-  queuePrintLine(36, 1, {0b00000000, 0b11111100, 0b00011111, 0b00000000, 0b00001100, 0b00110000, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00001111, 0b00000000, 0b11111000, 0b11111110, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111000, 0b00111110, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111});
-  queuePrintLine(37, 1, {0b00000000, 0b11111110, 0b00011111, 0b00000000, 0b00011100, 0b00111000, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00001111, 0b00000000, 0b11111000, 0b00111100, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00000000, 0b00000000, 0b11111000, 0b00111100, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111});
-  queuePrintLine(38, 1, {0b00000000, 0b11111111, 0b00011111, 0b00000000, 0b00111000, 0b00011100, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00001111, 0b00000000, 0b11111000, 0b00111100, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00000000, 0b00000000, 0b11111000, 0b00111100, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111});
-  queuePrintLine(39, 1, {0b00000000, 0b11111111, 0b10011111, 0b00000000, 0b00111000, 0b00011100, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00001111, 0b00000000, 0b11111000, 0b01111100, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00000000, 0b00000000, 0b11111000, 0b01111100, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111});
-  queuePrintLine(40, 1, {0b00000000, 0b11111011, 0b11111111, 0b00000000, 0b00111001, 0b10011100, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00001111, 0b00000000, 0b11111111, 0b11110000, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11111111, 0b11100000, 0b00000000, 0b11111111, 0b11110000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111});
-  queuePrintLine(41, 1, {0b00000000, 0b11111001, 0b11111111, 0b00000000, 0b00111111, 0b11111100, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00001111, 0b00000000, 0b11111111, 0b11110000, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11111111, 0b11100000, 0b00000000, 0b11111111, 0b11110000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111});
-  queuePrintLine(42, 1, {0b00000000, 0b11111000, 0b11111111, 0b00000000, 0b01111111, 0b11111110, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00001111, 0b00000000, 0b11111111, 0b11110000, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11111111, 0b11100000, 0b00000000, 0b11111111, 0b11110000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111});
-  queuePrintLine(43, 1, {0b00000000, 0b11111000, 0b01111111, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00001111, 0b00000000, 0b11111000, 0b01111100, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11111111, 0b11100000, 0b00000000, 0b11111000, 0b01111100, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111});
-  queuePrintLine(44, 1, {0b00000000, 0b11111000, 0b00111111, 0b00000000, 0b11111100, 0b00111111, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00001111, 0b00000000, 0b11111000, 0b00111100, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00000000, 0b00000000, 0b11111000, 0b00111100, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111});
-  queuePrintLine(45, 1, {0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00001111, 0b00000000, 0b11111000, 0b00011110, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00000000, 0b00000000, 0b11111000, 0b00011110, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111});
-  queuePrintLine(46, 1, {0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00000000, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111});
-  queuePrintLine(47, 1, {0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11111100, 0b00111111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11110000, 0b00000000, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111});
-  queuePrintLine(48, 1, {0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111});
-  queuePrintLine(49, 1, {0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111});
-  queuePrintLine(50, 1, {0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000111, 0b11100000, 0b00000000, 0b11111111, 0b11111111, 0b00000000, 0b11111000, 0b00011111, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b11111111});
+  static uint8_t frame[PrinterFraming::MAX_FRAME_SIZE];
+  size_t length;
+
+  while (frameCache.replaying() && printQueueHasRoom())
+  {
+    if (!frameCache.readFrame(frame, sizeof(frame), length))
+    {
+      if (frameCache.replayDamaged())
+      {
+        Serial.printf("Cached frames damaged from row %u, rendering the rest\n", nextSourceRow);
+        renderRemainingRows(nextSourceRow);
+        break;
+      }
+
+      frameCache.close();
+
+      Serial.printf("Replayed cached frames, cache %u hits / %u misses / %u evictions, %u entries, %u bytes\n",
+                    frameCache.hits,
+                    frameCache.misses,
+                    frameCache.evictions,
+                    frameCache.entryCount(),
+                    frameCache.totalBytes());
+
+      producingFrames.store(false, std::memory_order_release);
+      break;
+    }
+
+    queueCommand(frame, length);
+    nextSourceRow = RowFlowControl::frameLastRow(frame) + 1;
+  }
 }
 
-void processNextPrintingQueueLine()
+void refillPrintingQueue()
 {
-  if (printerCommands.empty())
+  // Nothing the sender sets up for a stream is touched before it says go
+  if (!producingFrames.load(std::memory_order_acquire))
   {
-    Serial.println("Printing queue empty");
-    sendEndLabelPrintDataExchange();
+    return;
+  }
 
-    delay(1000); // TODO: Get print status before ending the print
-    sendEndPrint();
+  // A half recorded or half replayed stream is dropped, never cached
+  if (abandonStream.exchange(false, std::memory_order_acq_rel))
+  {
+    activeRowSource = nullptr;
+    frameCache.abortRecording();
+    frameCache.close();
+    producingFrames.store(false, std::memory_order_release);
     return;
   }
 
-  PrinterCommand &command = printerCommands.front();
+  if (frameCache.replaying())
+  {
+    refillFromFrameCache();
 
-  Serial.print("->");
-  printHexData(command.data(), command.size());
-  Serial.println();
+    if (frameCache.replaying() || activeRowSource == nullptr)
+    {
+      return;
+    }
+  }
 
-  sendCommand(command);
+  while (activeRowSource != nullptr && printQueueHasRoom())
+  {
+    if (nextSourceRow >= activeRowSource->height())
+    {
+      rowEncoder.finish();
+      activeRowSource = nullptr;
+
+      if (frameCache.commitRecording())
+      {
+        Serial.printf("Cached encoded frames, %u entries, %u bytes\n", frameCache.entryCount(), frameCache.totalBytes());
+      }
+
+      Serial.printf("Encoded %u rows (%u blank) into %u frames: %u bitmap, %u indexed, %u whitespace, %u bytes saved\n",
+                    rowEncoder.rowsEncoded,
+                    rowEncoder.blankRows,
+                    rowEncoder.framesEmitted,
+                    rowEncoder.bitmapFrames,
+                    rowEncoder.indexedFrames,
+                    rowEncoder.whitespaceFrames,
+                    rowEncoder.bytesSaved);
+
+      producingFrames.store(false, std::memory_order_release);
+      break;
+    }
 
-  printerCommands.pop();
+    memset(sourceRowScratch, 0, sizeof(sourceRowScratch));
+    rowEncoder.addRow(activeRowSource->renderRow(nextSourceRow++, sourceRowScratch));
+  }
 }
 
-class AdvertisedPrinterDeviceCallbacks : public BLEAdvertisedDeviceCallbacks
+// Render task: sleeps until the sender starts a stream or frees queue space,
+// then renders and encodes rows until the queue is full again
+static void renderTaskMain(void *parameter)
 {
-  void onResult(BLEAdvertisedDevice advertisedDevice)
+  for (;;)
   {
-    if (advertisedDevice.getName() != PRINTER_DEVICE_NAME)
-    {
-      return;
-    }
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    refillPrintingQueue();
+  }
+}
 
-    advertisedDevice.getScan()->stop();
-    printerDeviceAddress = new BLEAddress(advertisedDevice.getAddress());
-    attemptConnectionToPrinter = true;
+void startRenderTask()
+{
+#if NIIMBOT_RENDER_TASK
+  if (xTaskCreatePinnedToCore(renderTaskMain, "render", RENDER_TASK_STACK_SIZE, nullptr, RENDER_TASK_PRIORITY, &renderTask, RENDER_TASK_CORE) != pdPASS)
+  {
+    renderTask = nullptr;
+    Serial.println("Render task not started, rendering on the loop task");
+  }
+#endif
+}
 
-    Serial.println("Printer found, connecting...");
+void requestFrames()
+{
+  if (renderTask != nullptr)
+  {
+    xTaskNotifyGive(renderTask);
+    return;
   }
+
+  refillPrintingQueue();
+}
+
+// The label is streamed once and the printer makes every copy from it, using
+// the page count in START and the quantity in SET_PRINT_DIMENSIONS. Firmware
+// that rejects a quantity gets one single-copy pass per label instead.
+struct PrintJob
+{
+  RowSource *source;
+  uint64_t cacheKey;
+  void (*render)();
+  uint16_t copies;
+  uint16_t copiesPerPass;
+  uint16_t passesRemaining;
+  uint32_t startedAt;
+  boolean active;
 };
 
-static void printerDataNotifyCallback(BLERemoteCharacteristic *pBLERemoteCharacteristic, uint8_t *data, size_t length, bool isNotify)
+static PrintJob printJob = {};
+
+// A job step whose command the tracker refused, tried again from the session
+// loop once a slot frees up
+static void (*refusedPrintStep)() = nullptr;
+
+static void retryPrintStep(void (*step)())
 {
-  Serial.print("<-");
-  printHexData(data, length);
-  Serial.println();
+  refusedPrintStep = step;
 }
 
-bool connectToPrinter(BLEAddress pAddress)
+void retryRefusedPrintStep()
 {
-  BLEClient *pClient = BLEDevice::createClient();
+  void (*step)() = refusedPrintStep;
+  refusedPrintStep = nullptr;
 
-  pClient->connect(pAddress);
-  Serial.println(" - Connected to Niimbot printer");
+  if (step != nullptr && printJob.active)
+  {
+    step();
+  }
+}
 
-  BLERemoteService *pRemoteService = pClient->getService(niimbotB1ServiceUUID);
+void startPrintPass();
+void startLabelStream();
 
-  if (pRemoteService == nullptr)
+static void renderPrintJob()
+{
+  if (printJob.render != nullptr)
   {
-    Serial.print("Failed to find our service UUID: ");
-    Serial.println(niimbotB1ServiceUUID.toString().c_str());
-    return false;
+    printJob.render();
+    printJob.render = nullptr;
   }
+}
 
-  printerCommunicationCharacteristic = pRemoteService->getCharacteristic(printerCommunicationCharacteristicUUID);
+static bool quantityAccepted(CommandResult result, const PrinterResponse &response)
+{
+  return result == CommandResult::Completed && (response.length == 0 || response.payload[0] != 0x00);
+}
 
-  if (printerCommunicationCharacteristic == nullptr)
+static void onFallbackPrintEnded(CommandResult result, const PrinterResponse &response, void *context)
+{
+  startPrintPass();
+}
+
+// Close the session opened for the rejected quantity before starting over
+static void endRejectedQuantityPass()
+{
+  if (!sendEndPrint(onFallbackPrintEnded))
   {
-    Serial.print("Failed to find our characteristic UUID");
-    return false;
+    retryPrintStep(endRejectedQuantityPass);
   }
+}
 
-  Serial.println(" - Found printer communication characteristic");
+static void fallBackToSingleCopies()
+{
+  Serial.printf("Printer rejected a quantity of %u, streaming every copy\n", printJob.copies);
 
-  printerCommunicationCharacteristic->registerForNotify(printerDataNotifyCallback);
-  return true;
+  printJob.copiesPerPass = 1;
+  printJob.passesRemaining = printJob.copies;
+
+  endRejectedQuantityPass();
 }
 
-void setup()
+static void onPrintPassDimensionsSet(CommandResult result, const PrinterResponse &response, void *context)
 {
-  Serial.begin(115200);
-  Serial.println("Starting Niimbot proxy...");
+  if (printJob.copiesPerPass > 1 && !quantityAccepted(result, response))
+  {
+    fallBackToSingleCopies();
+    return;
+  }
 
-  BLEDevice::init("B1-G121131121");
+  startLabelStream();
+}
 
-  // Setting up communication with the printer device
-  BLEScan *pBLEScan = BLEDevice::getScan();
-  pBLEScan->setAdvertisedDeviceCallbacks(new AdvertisedPrinterDeviceCallbacks());
-  pBLEScan->setActiveScan(true);
-  pBLEScan->start(30);
+static void sendPassDimensions()
+{
+  if (!sendPrintDimensions(printJob.source->height(), printJob.source->width(), printJob.copiesPerPass, onPrintPassDimensionsSet))
+  {
+    retryPrintStep(sendPassDimensions);
+  }
+}
+
+static void onPrintPassStarted(CommandResult result, const PrinterResponse &response, void *context)
+{
+  if (printJob.copiesPerPass > 1 && !quantityAccepted(result, response))
+  {
+    fallBackToSingleCopies();
+    return;
+  }
+
+  sendPassDimensions();
+}
 
-  while (!connectToPrinter(*printerDeviceAddress))
+// Replays the cached frames for the job when there are any, otherwise
+// renders the label and records its frames while they are encoded
+void startLabelStream()
+{
+  if (!printJob.active)
   {
-    continue;
+    return;
   }
 
-  sendSetLabelType();
-  sendSetDensity(3);
+  if (frameCache.open(printJob.cacheKey))
+  {
+    nextSourceRow = 0;
+    printing = true;
+    startProducing();
+    return;
+  }
 
-  sendGetPrintStatus();
+  renderPrintJob();
+  frameCache.beginRecording(printJob.cacheKey);
+  startRowStream(*printJob.source);
+}
 
-  sendStartLabelPrintDataExchange();
-  sendPrintDimensions(240, 128);
+// Renderer side, when a replay breaks off: the rest of the label is encoded
+// from the source, and not recorded since the stream is incomplete
+void renderRemainingRows(uint16_t firstRow)
+{
+  renderPrintJob();
 
-  queuePrint();
+  activeRowSource = printJob.source;
+  nextSourceRow = firstRow;
+  rowEncoder.begin(firstRow);
 }
 
-void loop()
+void startPrintPass()
 {
-  if (printing)
+  if (!printJob.active)
   {
-    processNextPrintingQueueLine();
+    return; // abandoned, the printer went away
+  }
+
+  if (!sendStartLabelPrintDataExchange(printJob.copiesPerPass, onPrintPassStarted))
+  {
+    retryPrintStep(startPrintPass);
+  }
+}
+
+// `render` draws whatever `source` reads from; it only runs on a cache miss
+void startPrintJob(RowSource &source, uint64_t cacheKey, void (*render)(), uint16_t copies)
+{
+  printJob = {&source, cacheKey, render, copies, copies, 1, static_cast<uint32_t>(millis()), true};
+  startPrintPass();
+}
+
+static void renderDemoLabel()
+{
+  label.clear();
+  drawDemoLabel(label);
+}
+
+// Everything the demo label's frames depend on
+static uint64_t demoLabelKey()
+{
+  return ContentHash()
+      .addValue(FrameCache::FORMAT_VERSION)
+      .addValue(LABEL_WIDTH)
+      .addValue(LABEL_HEIGHT)
+      .addValue(PRINT_DENSITY)
+      .addValue(DEMO_ARTWORK_TOP)
+      .add(DEMO_ARTWORK, sizeof(DEMO_ARTWORK))
+      .digest();
+}
+
+void queuePrint()
+{
+  startPrintJob(labelRowSource, demoLabelKey(), renderDemoLabel, LABEL_COPIES);
+}
+
+static void onPrintPassEnded(CommandResult result, const PrinterResponse &response, void *context)
+{
+  if (--printJob.passesRemaining > 0)
+  {
+    startPrintPass();
     return;
   }
 
-  sendHeartbeatSignal();
-  delay(1000);
+  printJob.active = false;
+
+  if (result == CommandResult::Completed)
+  {
+    printerState.clearError(millis());
+  }
+
+  uint32_t elapsed = millis() - printJob.startedAt;
+  Serial.printf("Printed %u copies in %u ms (%u per pass)\n", printJob.copies, elapsed, printJob.copiesPerPass);
+}
+
+// After the last row, GET_PRINT_STATUS is polled until the printer reports
+// every copy of the pass, and END_PRINT goes out on that reply. The interval
+// starts short, doubles while the status stands still and drops back as soon
+// as the printer reports progress.
+static const uint32_t STATUS_POLL_MIN_MS = 50;
+static const uint32_t STATUS_POLL_MAX_MS = 400;
+static const uint32_t COPY_PRINT_TIMEOUT_MS = 5000;
+
+struct CompletionPoll
+{
+  boolean active;
+  boolean awaitingReply;
+  boolean endPrintDue; // END_PRINT still to go out, retried until tracked
+  uint32_t lastRowSentAt;
+  uint32_t nextPollAt;
+  uint32_t interval;
+  uint32_t deadline;
+  uint16_t polls;
+  PrintStatus status;
+};
+
+// Last row written to END_PRINT sent, over every pass since boot
+struct EndOfPassStats
+{
+  uint32_t passes;
+  uint32_t totalLatencyMs;
+  uint32_t maxLatencyMs;
+  uint32_t polls;
+};
+
+static CompletionPoll completionPoll = {};
+static EndOfPassStats endOfPassStats = {};
+
+// Stays in the completion poll until END_PRINT could be sent, a full command
+// tracker would otherwise leave the job open forever
+void sendPassEnd()
+{
+  if (sendEndPrint(onPrintPassEnded))
+  {
+    completionPoll.active = false;
+    completionPoll.endPrintDue = false;
+  }
+}
+
+void finishPrintPass(uint32_t now)
+{
+  uint32_t latency = now - completionPoll.lastRowSentAt;
+
+  ++endOfPassStats.passes;
+  endOfPassStats.totalLatencyMs += latency;
+  endOfPassStats.polls += completionPoll.polls;
+
+  if (latency > endOfPassStats.maxLatencyMs)
+  {
+    endOfPassStats.maxLatencyMs = latency;
+  }
+
+  Serial.printf("Pass done at page %u: END_PRINT %u ms after the last row, %u status polls (avg %u ms, max %u ms)\n",
+                completionPoll.status.page,
+                latency,
+                completionPoll.polls,
+                endOfPassStats.totalLatencyMs / endOfPassStats.passes,
+                endOfPassStats.maxLatencyMs);
+
+  completionPoll.endPrintDue = true;
+  sendPassEnd();
+}
+
+static void onPrintStatusPolled(CommandResult result, const PrinterResponse &response, void *context)
+{
+  uint32_t now = millis();
+  PrintStatus status;
+
+  completionPoll.awaitingReply = false;
+
+  // Without a usable status there is nothing to wait for
+  if (result != CommandResult::Completed || !decodePrintStatus(response.payload, response.length, status))
+  {
+    finishPrintPass(now);
+    return;
+  }
+
+  if (status.page >= printJob.copiesPerPass || deadlineReached(now, completionPoll.deadline))
+  {
+    completionPoll.status = status;
+    finishPrintPass(now);
+    return;
+  }
+
+  boolean progressed = status.page != completionPoll.status.page ||
+                       status.printProgress != completionPoll.status.printProgress ||
+                       status.feedProgress != completionPoll.status.feedProgress;
+
+  completionPoll.status = status;
+  completionPoll.interval = progressed ? STATUS_POLL_MIN_MS : completionPoll.interval * 2;
+
+  if (completionPoll.interval > STATUS_POLL_MAX_MS)
+  {
+    completionPoll.interval = STATUS_POLL_MAX_MS;
+  }
+
+  completionPoll.nextPollAt = now + completionPoll.interval;
+}
+
+void pollPrintCompletion(uint32_t now)
+{
+  if (completionPoll.active && completionPoll.endPrintDue)
+  {
+    sendPassEnd();
+    return;
+  }
+
+  if (!completionPoll.active || completionPoll.awaitingReply || !deadlineReached(now, completionPoll.nextPollAt))
+  {
+    return;
+  }
+
+  if (sendGetPrintStatus(onPrintStatusPolled))
+  {
+    completionPoll.awaitingReply = true;
+    ++completionPoll.polls;
+  }
+}
+
+static void onLabelDataExchangeEnded(CommandResult result, const PrinterResponse &response, void *context)
+{
+  if (!printJob.active)
+  {
+    return;
+  }
+
+  uint32_t now = millis();
+
+  completionPoll.active = true;
+  completionPoll.awaitingReply = false;
+  completionPoll.endPrintDue = false;
+  completionPoll.nextPollAt = now;
+  completionPoll.interval = STATUS_POLL_MIN_MS;
+  completionPoll.deadline = now + printJob.copiesPerPass * COPY_PRINT_TIMEOUT_MS;
+  completionPoll.polls = 0;
+  completionPoll.status = {};
+}
+
+void reportRowStreamStats()
+{
+  uint32_t elapsed = millis() - rowStreamStats.startedAt;
+
+  Serial.printf("Streamed %u rows in %u frames (%u acknowledged) in %u ms, %.1f rows/s [%s]\n",
+                rowStreamStats.rows,
+                rowStreamStats.frames,
+                rowStreamStats.synchronizedWrites,
+                elapsed,
+                elapsed > 0 ? rowStreamStats.rows * 1000.0 / elapsed : 0.0,
+                STREAM_ROWS ? "write without response" : "acknowledged writes");
+
+  if (writeStats.writes > 0)
+  {
+    Serial.printf("%u writes, %u bytes, %.1f bytes/write, %.1f us/write\n",
+                  writeStats.writes,
+                  writeStats.bytes,
+                  static_cast<float>(writeStats.bytes) / writeStats.writes,
+                  static_cast<float>(writeStats.microseconds) / writeStats.writes);
+  }
+}
+
+void processNextPrintingQueueLine()
+{
+  requestFrames();
+
+  if (printerCommands.empty() && !rowStreamActive())
+  {
+    // Tried again on the next loop while the command tracker is full
+    if (!endingPrint && sendEndLabelPrintDataExchange(onLabelDataExchangeEnded))
+    {
+      Serial.println("Printing queue empty");
+      completionPoll.lastRowSentAt = millis();
+      reportRowStreamStats();
+      endingPrint = true;
+    }
+
+    return;
+  }
+
+  if (printerCommands.empty())
+  {
+    return; // the renderer is still catching up
+  }
+
+  uint32_t now = millis();
+  boolean synchronize = !STREAM_ROWS || rowFlowControl.stalled(now);
+
+  if (!synchronize && !rowFlowControl.hasCredit())
+  {
+    return; // wait for the printer to report progress
+  }
+
+  if (rowStreamStats.frames == 0)
+  {
+    rowStreamStats.startedAt = now;
+    rowFlowControl.reset(now);
+
+    uint16_t mtu = printerClient->getMTU();
+    rowBatch.setMtu(mtu);
+    Serial.printf("Streaming rows with an MTU of %u\n", mtu);
+  }
+
+  // Pack as many queued frames as fit into one write and the window allows
+  rowBatch.clear();
+
+  while (!printerCommands.empty())
+  {
+    size_t commandLength;
+    const uint8_t *command = printerCommands.front(commandLength);
+
+    if (!rowBatch.fits(commandLength) && !rowBatch.empty())
+    {
+      break;
+    }
+
+    uint16_t lastRow = RowFlowControl::frameLastRow(command);
+
+#if NIIMBOT_LOG_FRAMES
+    Serial.print("->");
+    printHexData(command, commandLength);
+    Serial.println();
+#endif
+
+    if (!rowBatch.append(command, commandLength))
+    {
+      // Larger than the MTU allows, only an acknowledged (long) write can carry it
+      sendCommand(command, commandLength, true);
+      synchronize = true;
+    }
+    else if (!synchronize)
+    {
+      rowFlowControl.onSent(lastRow);
+    }
+
+    rowStreamStats.rows = lastRow + 1;
+    ++rowStreamStats.frames;
+
+    printerCommands.pop();
+    requestFrames();
+
+    if (rowBatch.empty() || (!synchronize && !rowFlowControl.hasCredit()))
+    {
+      break;
+    }
+  }
+
+  if (!rowBatch.empty())
+  {
+    sendCommand(rowBatch.data(), rowBatch.size(), synchronize);
+  }
+
+  if (synchronize)
+  {
+    rowFlowControl.onSynchronized(millis());
+    ++rowStreamStats.synchronizedWrites;
+  }
+}
+
+class AdvertisedPrinterDeviceCallbacks : public BLEAdvertisedDeviceCallbacks
+{
+  void onResult(BLEAdvertisedDevice advertisedDevice)
+  {
+    if (advertisedDevice.getName() != PRINTER_DEVICE_NAME || attemptConnectionToPrinter)
+    {
+      return;
+    }
+
+    advertisedDevice.getScan()->stop();
+
+    delete printerDeviceAddress;
+    printerDeviceAddress = new BLEAddress(advertisedDevice.getAddress());
+    attemptConnectionToPrinter = true;
+
+    Serial.println("Printer found, connecting...");
+  }
+};
+
+class PrinterClientCallbacks : public BLEClientCallbacks
+{
+  void onConnect(BLEClient *client) {}
+
+  void onDisconnect(BLEClient *client)
+  {
+    connectionLost = true;
+  }
+};
+
+static void printerDataNotifyCallback(BLERemoteCharacteristic *pBLERemoteCharacteristic, uint8_t *data, size_t length, bool isNotify)
+{
+  responseDecoder.receive(data, length);
+}
+
+// Sees every GATT client event, but only acts while the link runs on saved
+// handles; otherwise the library's characteristic objects handle them
+static void printerGattcEventHandler(esp_gattc_cb_event_t event, esp_gatt_if_t gattcIf, esp_ble_gattc_cb_param_t *param)
+{
+  // Arrives while connect() is still running, before linkInterface and
+  // linkConnection are known; ours is the only client
+  if (event == ESP_GATTC_DIS_SRVC_CMPL_EVT)
+  {
+    if (param->dis_srvc_cmpl.status == ESP_GATT_OK)
+    {
+      xSemaphoreGive(linkServicesDiscovered);
+    }
+    return;
+  }
+
+  if (!linkOnSavedHandles || gattcIf != linkInterface)
+  {
+    return;
+  }
+
+  if (event == ESP_GATTC_NOTIFY_EVT)
+  {
+    if (param->notify.conn_id == linkConnection && param->notify.handle == linkHandles.characteristic)
+    {
+      responseDecoder.receive(param->notify.value, param->notify.value_len);
+    }
+  }
+  else if (event == ESP_GATTC_WRITE_CHAR_EVT || event == ESP_GATTC_WRITE_DESCR_EVT)
+  {
+    if (param->write.conn_id == linkConnection)
+    {
+      xSemaphoreGive(linkWriteDone);
+    }
+  }
+}
+
+// Looked up in the stack's local attribute table, without any ATT traffic:
+// the saved handle must still carry the communication characteristic inside
+// the saved service range. Only meaningful once service discovery completed.
+static bool savedGattHandlesMatch(BLEAddress &address)
+{
+  if (!gattHandlesSaved)
+  {
+    return false;
+  }
+
+  if (memcmp(savedGattHandles.address, *address.getNative(), sizeof(esp_bd_addr_t)) != 0)
+  {
+    Serial.println(" - Saved GATT handles belong to another printer, discovering");
+    return false;
+  }
+
+  if (xSemaphoreTake(linkServicesDiscovered, pdMS_TO_TICKS(SERVICE_DISCOVERY_TIMEOUT_MS)) != pdTRUE)
+  {
+    Serial.println(" - Service discovery did not complete, discovering");
+    return false;
+  }
+
+  esp_gattc_char_elem_t found;
+  uint16_t count = 1;
+
+  if (esp_ble_gattc_get_char_by_uuid(linkInterface, linkConnection, savedGattHandles.serviceStart, savedGattHandles.serviceEnd,
+                                     *printerCommunicationCharacteristicUUID.getNative(), &found, &count) != ESP_GATT_OK ||
+      count == 0 || found.char_handle != savedGattHandles.characteristic)
+  {
+    Serial.println(" - Saved GATT handles no longer match the printer, discovering");
+    return false;
+  }
+
+  return true;
+}
+
+static bool discoverPrinterCharacteristic(BLEAddress &address)
+{
+  BLERemoteService *pRemoteService = printerClient->getService(niimbotB1ServiceUUID);
+
+  if (pRemoteService == nullptr)
+  {
+    Serial.print("Failed to find our service UUID: ");
+    Serial.println(niimbotB1ServiceUUID.toString().c_str());
+    return false;
+  }
+
+  printerCommunicationCharacteristic = pRemoteService->getCharacteristic(printerCommunicationCharacteristicUUID);
+
+  if (printerCommunicationCharacteristic == nullptr)
+  {
+    Serial.print("Failed to find our characteristic UUID");
+    return false;
+  }
+
+  Serial.println(" - Found printer communication characteristic");
+
+  BLERemoteDescriptor *clientConfiguration = printerCommunicationCharacteristic->getDescriptor(BLEUUID((uint16_t)0x2902));
+
+  memcpy(linkHandles.address, *address.getNative(), sizeof(esp_bd_addr_t));
+  linkHandles.serviceStart = pRemoteService->getStartHandle();
+  linkHandles.serviceEnd = pRemoteService->getEndHandle();
+  linkHandles.characteristic = printerCommunicationCharacteristic->getHandle();
+  linkHandles.clientConfiguration = clientConfiguration != nullptr ? clientConfiguration->getHandle() : 0;
+  return true;
+}
+
+static bool subscribeOnSavedHandles(BLEAddress &address)
+{
+  static const uint8_t enableNotifications[] = {0x01, 0x00};
+
+  linkOnSavedHandles = true;
+  esp_ble_gattc_register_for_notify(linkInterface, *address.getNative(), linkHandles.characteristic);
+
+  return writeAttribute(linkHandles.clientConfiguration, enableNotifications, sizeof(enableNotifications), true);
+}
+
+bool connectToPrinter(BLEAddress pAddress)
+{
+  if (printerClient == nullptr)
+  {
+    printerClient = BLEDevice::createClient();
+    printerClient->setClientCallbacks(new PrinterClientCallbacks());
+
+    linkWriteDone = xSemaphoreCreateBinary();
+    linkServicesDiscovered = xSemaphoreCreateBinary();
+    BLEDevice::setCustomGattcHandler(printerGattcEventHandler);
+  }
+
+  linkOnSavedHandles = false;
+  xSemaphoreTake(linkServicesDiscovered, 0);
+  uint32_t startedAt = millis();
+
+  if (!printerClient->connect(pAddress))
+  {
+    Serial.println(" - Failed to connect to Niimbot printer");
+    return false;
+  }
+
+  uint32_t connectedAt = millis();
+  Serial.println(" - Connected to Niimbot printer");
+
+  // The MTU exchange requested on connect (see BLEDevice::setMTU) completes
+  // later; the row batch picks up its result when a stream starts
+  esp_ble_gap_set_pkt_data_len(*pAddress.getNative(), PREFERRED_DATA_LENGTH);
+
+  linkInterface = printerClient->getGattcIf();
+  linkConnection = printerClient->getConnId();
+
+  bool usedSavedHandles = savedGattHandlesMatch(pAddress);
+
+  if (usedSavedHandles)
+  {
+    linkHandles = savedGattHandles;
+  }
+  else if (!discoverPrinterCharacteristic(pAddress))
+  {
+    printerClient->disconnect();
+    return false;
+  }
+
+  uint32_t discoveredAt = millis();
+
+  if (usedSavedHandles && !subscribeOnSavedHandles(pAddress))
+  {
+    Serial.println(" - Saved GATT handles rejected, discovering");
+
+    linkOnSavedHandles = false;
+    usedSavedHandles = false;
+
+    if (!discoverPrinterCharacteristic(pAddress))
+    {
+      printerClient->disconnect();
+      return false;
+    }
+  }
+
+  if (!usedSavedHandles)
+  {
+    printerCommunicationCharacteristic->registerForNotify(printerDataNotifyCallback);
+  }
+
+  Serial.printf(" - Connect %u ms, discovery %u ms (%s), subscribe %u ms\n",
+                connectedAt - startedAt, discoveredAt - connectedAt,
+                usedSavedHandles ? "saved handles" : "full", millis() - discoveredAt);
+
+  connectedToPrinter = true;
+  return true;
+}
+
+// The connection and print session, advanced from loop() by printer
+// responses and millis() deadlines. No state ever waits in place, so
+// notifications and new jobs are handled on the next pass through loop().
+enum class SessionState
+{
+  Scanning,
+  Connecting,
+  Configuring,
+  Idle,
+  Printing
+};
+
+static const uint32_t SCAN_DURATION_S = 30;
+static const uint32_t CONNECT_RETRY_DELAY_MS = 1000;
+static const uint8_t CONNECT_ATTEMPTS = 3;
+static const uint8_t SAVED_PRINTER_CONNECT_ATTEMPTS = 1;
+static const uint32_t HEARTBEAT_INTERVAL_MS = 1000;
+static const uint32_t PRINTER_STATE_MAX_AGE_MS = 5000;
+
+static SessionState sessionState = SessionState::Scanning;
+static uint32_t sessionStateSince = 0;
+static uint32_t nextConnectAttemptAt = 0;
+static uint8_t connectAttempts = 0;
+static uint8_t configurationPending = 0;
+static boolean configurationRefused = false;
+static uint32_t nextHeartbeatAt = 0;
+static boolean demoPrintPending = true;
+static const char *printHeldFor = nullptr;
+
+// The last printer that got ready is kept in NVS, so a reboot can connect to
+// it directly instead of scanning for it
+static const char *PREFERENCES_NAMESPACE = "niimbot";
+static const char *SAVED_PRINTER_KEY = "printer";
+static const char *GATT_HANDLES_KEY = "gatt";
+
+static Preferences preferences;
+static String savedPrinterAddress;
+static boolean connectingToSavedPrinter = false;
+static boolean savedPrinterFailed = false;
+static boolean readyReported = false;
+
+static const char *sessionStateName(SessionState state)
+{
+  switch (state)
+  {
+  case SessionState::Scanning:
+    return "scanning";
+  case SessionState::Connecting:
+    return "connecting";
+  case SessionState::Configuring:
+    return "configuring";
+  case SessionState::Idle:
+    return "idle";
+  default:
+    return "printing";
+  }
+}
+
+void enterSessionState(SessionState state)
+{
+  uint32_t now = millis();
+
+  Serial.printf("Session %s -> %s after %u ms\n", sessionStateName(sessionState), sessionStateName(state), now - sessionStateSince);
+
+  sessionState = state;
+  sessionStateSince = now;
+}
+
+static void onScanComplete(BLEScanResults results)
+{
+  scanFinished = true;
+}
+
+void startScan()
+{
+  if (connectingToSavedPrinter)
+  {
+    connectingToSavedPrinter = false;
+    savedPrinterFailed = true;
+  }
+
+  attemptConnectionToPrinter = false;
+  scanFinished = false;
+
+  BLEDevice::getScan()->start(SCAN_DURATION_S, onScanComplete, false);
+  enterSessionState(SessionState::Scanning);
+}
+
+bool loadSavedPrinterAddress()
+{
+  preferences.begin(PREFERENCES_NAMESPACE, true);
+  savedPrinterAddress = preferences.getString(SAVED_PRINTER_KEY, "");
+  gattHandlesSaved = preferences.getBytes(GATT_HANDLES_KEY, &savedGattHandles, sizeof(savedGattHandles)) == sizeof(savedGattHandles);
+  preferences.end();
+
+  if (savedPrinterAddress.length() == 0)
+  {
+    return false;
+  }
+
+  delete printerDeviceAddress;
+  printerDeviceAddress = new BLEAddress(savedPrinterAddress.c_str());
+  return true;
+}
+
+// Only written when the printer changed, NVS wears with every write
+void savePrinterAddress(BLEAddress address)
+{
+  String current = address.toString().c_str();
+
+  if (current == savedPrinterAddress)
+  {
+    return;
+  }
+
+  preferences.begin(PREFERENCES_NAMESPACE, false);
+  preferences.putString(SAVED_PRINTER_KEY, current.c_str());
+  preferences.end();
+
+  savedPrinterAddress = current;
+}
+
+void saveGattHandles()
+{
+  // Without the notification descriptor the handles can't subscribe alone
+  if (linkHandles.clientConfiguration == 0 ||
+      (gattHandlesSaved && memcmp(&linkHandles, &savedGattHandles, sizeof(GattHandles)) == 0))
+  {
+    return;
+  }
+
+  preferences.begin(PREFERENCES_NAMESPACE, false);
+  preferences.putBytes(GATT_HANDLES_KEY, &linkHandles, sizeof(linkHandles));
+  preferences.end();
+
+  savedGattHandles = linkHandles;
+  gattHandlesSaved = true;
+}
+
+void connectToSavedPrinter()
+{
+  Serial.printf("Connecting to saved printer %s\n", savedPrinterAddress.c_str());
+
+  connectingToSavedPrinter = true;
+  connectAttempts = 0;
+  nextConnectAttemptAt = millis();
+  enterSessionState(SessionState::Connecting);
+}
+
+void onPrinterReady()
+{
+  enterSessionState(SessionState::Idle);
+  savePrinterAddress(*printerDeviceAddress);
+  saveGattHandles();
+
+  if (!readyReported)
+  {
+    readyReported = true;
+
+    const char *path = connectingToSavedPrinter ? "saved address"
+                       : savedPrinterFailed     ? "saved address failed, scan"
+                                                : "scan";
+
+    Serial.printf("Ready %u ms after boot (%s)\n", millis(), path);
+  }
+
+  connectingToSavedPrinter = false;
+}
+
+static void onConfigurationReply(CommandResult result, const PrinterResponse &response, void *context)
+{
+  if (--configurationPending == 0 && sessionState == SessionState::Configuring && !configurationRefused)
+  {
+    onPrinterReady();
+  }
+}
+
+static void countConfigurationRequest(bool sent)
+{
+  if (sent)
+  {
+    ++configurationPending;
+  }
+  else
+  {
+    configurationRefused = true;
+  }
+}
+
+// Independent configuration and status queries are pipelined; the heartbeat
+// fills the printer state that job admission reads. When the tracker refuses
+// any of them, runSession sends all of them again once the rest are answered.
+void configurePrinter()
+{
+  configurationPending = 0;
+  configurationRefused = false;
+
+  countConfigurationRequest(sendSetLabelType(onConfigurationReply));
+  countConfigurationRequest(sendSetDensity(PRINT_DENSITY, onConfigurationReply));
+  countConfigurationRequest(sendHeartbeatSignal(onConfigurationReply));
+}
+
+// Frames rendered for a stream the printer will never see
+void discardQueuedFrames()
+{
+  while (!printerCommands.empty())
+  {
+    printerCommands.pop();
+  }
+
+  if (rowStreamActive())
+  {
+    requestFrames();
+  }
+}
+
+void onPrinterDisconnected()
+{
+  Serial.println("Printer disconnected");
+
+  connectedToPrinter = false;
+  linkOnSavedHandles = false;
+  completionPoll.active = false;
+  printJob.active = false;
+  printing = false;
+  endingPrint = false;
+
+  // Nothing sent on the old link will be answered
+  commandTracker.cancelAll();
+  stopProducing();
+
+  startScan();
+}
+
+void runSession(uint32_t now)
+{
+  if (connectionLost)
+  {
+    connectionLost = false;
+
+    if (connectedToPrinter)
+    {
+      onPrinterDisconnected();
+    }
+  }
+
+  switch (sessionState)
+  {
+  case SessionState::Scanning:
+    discardQueuedFrames();
+
+    if (attemptConnectionToPrinter)
+    {
+      attemptConnectionToPrinter = false;
+      connectAttempts = 0;
+      nextConnectAttemptAt = now;
+      enterSessionState(SessionState::Connecting);
+    }
+    else if (scanFinished)
+    {
+      Serial.println("Printer not found, scanning again");
+      startScan();
+    }
+    break;
+
+  case SessionState::Connecting:
+    discardQueuedFrames();
+
+    if (!deadlineReached(now, nextConnectAttemptAt))
+    {
+      break;
+    }
+
+    if (connectToPrinter(*printerDeviceAddress))
+    {
+      enterSessionState(SessionState::Configuring);
+      configurePrinter();
+    }
+    else if (++connectAttempts < (connectingToSavedPrinter ? SAVED_PRINTER_CONNECT_ATTEMPTS : CONNECT_ATTEMPTS))
+    {
+      nextConnectAttemptAt = millis() + CONNECT_RETRY_DELAY_MS;
+    }
+    else
+    {
+      if (connectingToSavedPrinter)
+      {
+        Serial.println("Saved printer not reachable, scanning instead");
+      }
+
+      startScan();
+    }
+    break;
+
+  case SessionState::Configuring:
+    // onConfigurationReply moves on once everything was sent and answered
+    if (configurationRefused && configurationPending == 0)
+    {
+      configurePrinter();
+    }
+    break;
+
+  case SessionState::Idle:
+    if (demoPrintPending)
+    {
+      // Admission reads the cached state, idle heartbeats keep it fresh
+      const char *blocker = printerState.printBlocker(now, PRINTER_STATE_MAX_AGE_MS);
+
+      if (blocker == nullptr)
+      {
+        demoPrintPending = false;
+        printHeldFor = nullptr;
+        enterSessionState(SessionState::Printing);
+        queuePrint();
+        break;
+      }
+
+      if (blocker != printHeldFor)
+      {
+        Serial.printf("Print held: %s\n", blocker);
+        printHeldFor = blocker;
+      }
+    }
+
+    // A refused heartbeat is tried again on the next loop
+    if (deadlineReached(now, nextHeartbeatAt) &&
+        (commandTracker.isTracking(PrinterCommands::HEARTBEAT) || sendHeartbeatSignal()))
+    {
+      nextHeartbeatAt = now + HEARTBEAT_INTERVAL_MS;
+    }
+    break;
+
+  case SessionState::Printing:
+    // No heartbeats here, the link is kept for rows and status polls
+    retryRefusedPrintStep();
+    pollPrintCompletion(now);
+
+    if (printing)
+    {
+      processNextPrintingQueueLine();
+    }
+    else if (!printJob.active)
+    {
+      enterSessionState(SessionState::Idle);
+    }
+    break;
+  }
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  Serial.println("Starting Niimbot proxy...");
+
+#ifdef NIIMBOT_BENCHMARK
+  runBenchmarks();
+#endif
+
+  if (!frameCache.begin())
+  {
+    Serial.println("Frame cache unavailable, every label will be rendered");
+  }
+
+  startRenderTask();
+
+  BLEDevice::init("B1-G121131121");
+  BLEDevice::setMTU(PREFERRED_MTU);
+
+  // Setting up communication with the printer device
+  BLEScan *pBLEScan = BLEDevice::getScan();
+  pBLEScan->setAdvertisedDeviceCallbacks(new AdvertisedPrinterDeviceCallbacks());
+  pBLEScan->setActiveScan(true);
+
+  if (loadSavedPrinterAddress())
+  {
+    connectToSavedPrinter();
+  }
+  else
+  {
+    startScan();
+  }
+}
+
+void loop()
+{
+  pumpPrinterResponses();
+  runSession(millis());
 }
@@ -0,0 +1,32 @@
+#include <unity.h>
+
+#include "Benchmark.h"
+
+// Nothing is asserted: each group prints its timings and passes once it has
+// run to the end. Pass -v to pio test to see them.
+void setUp() {}
+void tearDown() {}
+
+void test_row_encoder()
+{
+  benchmarkRowEncoder();
+}
+
+void test_text_renderer()
+{
+  benchmarkTextRenderer();
+}
+
+void test_barcodes()
+{
+  benchmarkBarcodes();
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_row_encoder);
+  RUN_TEST(test_text_renderer);
+  RUN_TEST(test_barcodes);
+  return UNITY_END();
+}
@@ -0,0 +1,91 @@
+#include <unity.h>
+
+#include "CommandTracker.h"
+
+struct Outcome
+{
+  bool called;
+  CommandResult result;
+};
+
+static void recordOutcome(CommandResult result, const PrinterResponse &, void *context)
+{
+  Outcome *outcome = static_cast<Outcome *>(context);
+
+  outcome->called = true;
+  outcome->result = result;
+}
+
+static PrinterResponse response(uint8_t code)
+{
+  static const uint8_t payload[] = {0x01};
+  return {code, payload, sizeof(payload)};
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_answer_resolves_oldest_match()
+{
+  CommandTracker tracker;
+  Outcome first = {}, second = {};
+
+  tracker.track(PrinterCommands::GET_PRINT_STATUS, recordOutcome, &first, 0, 1000);
+  tracker.track(PrinterCommands::GET_PRINT_STATUS, recordOutcome, &second, 10, 1000);
+
+  TEST_ASSERT_TRUE(tracker.resolve(response(PrinterResponses::PRINT_STATUS)));
+  TEST_ASSERT_TRUE(first.called);
+  TEST_ASSERT_FALSE(second.called);
+  TEST_ASSERT_EQUAL(1, tracker.inFlight());
+}
+
+void test_error_skips_heartbeat_and_status_poll()
+{
+  CommandTracker tracker;
+  Outcome heartbeat = {}, density = {}, status = {};
+
+  tracker.track(PrinterCommands::HEARTBEAT, recordOutcome, &heartbeat, 0, 1000);
+  tracker.track(PrinterCommands::SET_PRINT_DENSITY, recordOutcome, &density, 10, 1000);
+  tracker.track(PrinterCommands::GET_PRINT_STATUS, recordOutcome, &status, 20, 1000);
+
+  TEST_ASSERT_TRUE(tracker.resolve(response(PrinterResponses::PRINT_ERROR)));
+  TEST_ASSERT_FALSE(heartbeat.called);
+  TEST_ASSERT_FALSE(status.called);
+  TEST_ASSERT_TRUE(density.called);
+  TEST_ASSERT_TRUE(density.result == CommandResult::Rejected);
+}
+
+void test_error_blames_most_recent_command()
+{
+  CommandTracker tracker;
+  Outcome labelType = {}, dimensions = {};
+
+  tracker.track(PrinterCommands::SET_LABEL_TYPE, recordOutcome, &labelType, 0, 1000);
+  tracker.track(PrinterCommands::SET_PRINT_DIMENSIONS, recordOutcome, &dimensions, 10, 1000);
+
+  TEST_ASSERT_TRUE(tracker.resolve(response(PrinterResponses::NOT_SUPPORTED)));
+  TEST_ASSERT_FALSE(labelType.called);
+  TEST_ASSERT_TRUE(dimensions.called);
+}
+
+void test_error_with_only_polls_pending_is_unmatched()
+{
+  CommandTracker tracker;
+  Outcome heartbeat = {};
+
+  tracker.track(PrinterCommands::HEARTBEAT, recordOutcome, &heartbeat, 0, 1000);
+
+  TEST_ASSERT_FALSE(tracker.resolve(response(PrinterResponses::PRINT_ERROR)));
+  TEST_ASSERT_FALSE(heartbeat.called);
+  TEST_ASSERT_EQUAL(1, tracker.inFlight());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_answer_resolves_oldest_match);
+  RUN_TEST(test_error_skips_heartbeat_and_status_poll);
+  RUN_TEST(test_error_blames_most_recent_command);
+  RUN_TEST(test_error_with_only_polls_pending_is_unmatched);
+  return UNITY_END();
+}
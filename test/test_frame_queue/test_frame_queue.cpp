@@ -0,0 +1,163 @@
+#include <atomic>
+#include <thread>
+
+#include <unity.h>
+
+#include "FrameQueue.h"
+
+static const size_t MAX_TEST_FRAME = 60;
+
+// Lengths cycle through odd and even sizes so records wrap at every offset
+static size_t frameLength(uint32_t sequence)
+{
+  return 1 + (sequence * 7) % MAX_TEST_FRAME;
+}
+
+static void fillFrame(uint8_t *frame, uint32_t sequence)
+{
+  for (size_t i = 0; i < frameLength(sequence); ++i)
+  {
+    frame[i] = static_cast<uint8_t>(sequence + i);
+  }
+}
+
+static bool frameMatches(const uint8_t *frame, size_t length, uint32_t sequence)
+{
+  if (length != frameLength(sequence))
+  {
+    return false;
+  }
+
+  for (size_t i = 0; i < length; ++i)
+  {
+    if (frame[i] != static_cast<uint8_t>(sequence + i))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_empty_queue_has_no_front()
+{
+  FrameQueue<64> queue;
+  size_t length = 1;
+
+  TEST_ASSERT_NULL(queue.front(length));
+  TEST_ASSERT_EQUAL(0, length);
+  TEST_ASSERT_TRUE(queue.empty());
+
+  queue.pop();
+  TEST_ASSERT_EQUAL(0, queue.bytesUsed());
+}
+
+void test_full_queue_refuses_frames_unchanged()
+{
+  FrameQueue<64> queue;
+  uint8_t frame[MAX_TEST_FRAME] = {};
+
+  TEST_ASSERT_TRUE(queue.push(frame, 30));
+  TEST_ASSERT_FALSE(queue.fits(40));
+  TEST_ASSERT_FALSE(queue.push(frame, 40));
+  TEST_ASSERT_EQUAL(1, queue.frameCount());
+  TEST_ASSERT_EQUAL(32, queue.bytesUsed());
+}
+
+void test_frames_come_out_in_order_across_wraps()
+{
+  FrameQueue<256> queue;
+  uint8_t frame[MAX_TEST_FRAME];
+  uint32_t pushed = 0;
+  uint32_t popped = 0;
+
+  while (popped < 5000)
+  {
+    fillFrame(frame, pushed);
+
+    while (queue.push(frame, frameLength(pushed)))
+    {
+      fillFrame(frame, ++pushed);
+    }
+
+    // Drain about half, so the next pushes start at a different offset
+    for (size_t n = queue.frameCount() / 2 + 1; n > 0; --n)
+    {
+      size_t length;
+      const uint8_t *front = queue.front(length);
+
+      TEST_ASSERT_NOT_NULL(front);
+      TEST_ASSERT_TRUE(frameMatches(front, length, popped));
+
+      queue.pop();
+      ++popped;
+    }
+  }
+}
+
+// One producer and one consumer thread, as the render task and the loop task
+// use the queue on the device
+void test_producer_and_consumer_threads()
+{
+  static FrameQueue<256> queue;
+  const uint32_t frames = 200000;
+  std::atomic<bool> stop(false);
+
+  std::thread producer([&]()
+                       {
+                         uint8_t frame[MAX_TEST_FRAME];
+
+                         for (uint32_t sequence = 0; sequence < frames && !stop.load();)
+                         {
+                           fillFrame(frame, sequence);
+
+                           if (queue.push(frame, frameLength(sequence)))
+                           {
+                             ++sequence;
+                           }
+                           else
+                           {
+                             std::this_thread::yield();
+                           }
+                         } });
+
+  uint32_t received = 0;
+  bool intact = true;
+
+  while (received < frames && intact)
+  {
+    size_t length;
+    const uint8_t *front = queue.front(length);
+
+    if (front == nullptr)
+    {
+      std::this_thread::yield();
+      continue;
+    }
+
+    intact = frameMatches(front, length, received);
+    queue.pop();
+    ++received;
+  }
+
+  // Assert only once the producer is gone, a failing assertion leaves here
+  stop = true;
+  producer.join();
+
+  TEST_ASSERT_TRUE(intact);
+  TEST_ASSERT_EQUAL(frames, received);
+  TEST_ASSERT_TRUE(queue.empty());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_empty_queue_has_no_front);
+  RUN_TEST(test_full_queue_refuses_frames_unchanged);
+  RUN_TEST(test_frames_come_out_in_order_across_wraps);
+  RUN_TEST(test_producer_and_consumer_threads);
+  return UNITY_END();
+}
@@ -0,0 +1,114 @@
+#include <vector>
+
+#include <unity.h>
+
+#include "ResponseDecoder.h"
+
+typedef std::vector<uint8_t> Bytes;
+
+static std::vector<Bytes> responses;
+
+static void collectResponse(const PrinterResponse &response)
+{
+  Bytes decoded = {response.code};
+  decoded.insert(decoded.end(), response.payload, response.payload + response.length);
+  responses.push_back(decoded);
+}
+
+static Bytes frame(uint8_t code, const Bytes &body)
+{
+  Bytes bytes = {0x55, 0x55, code, static_cast<uint8_t>(body.size())};
+  uint8_t checksum = code ^ static_cast<uint8_t>(body.size());
+
+  for (uint8_t value : body)
+  {
+    bytes.push_back(value);
+    checksum ^= value;
+  }
+
+  bytes.push_back(checksum);
+  bytes.push_back(0xAA);
+  bytes.push_back(0xAA);
+  return bytes;
+}
+
+static void receive(ResponseDecoder &decoder, const Bytes &bytes)
+{
+  decoder.receive(bytes.data(), bytes.size());
+}
+
+void setUp()
+{
+  responses.clear();
+}
+
+void tearDown() {}
+
+void test_frame_split_across_notifications()
+{
+  ResponseDecoder decoder;
+  Bytes heartbeat = frame(0xDD, {0x01, 0x02, 0x03});
+
+  receive(decoder, Bytes(heartbeat.begin(), heartbeat.begin() + 5));
+  TEST_ASSERT_EQUAL(0, decoder.process(collectResponse));
+
+  receive(decoder, Bytes(heartbeat.begin() + 5, heartbeat.end()));
+  TEST_ASSERT_EQUAL(1, decoder.process(collectResponse));
+  TEST_ASSERT_TRUE((responses[0] == Bytes{0xDD, 0x01, 0x02, 0x03}));
+  TEST_ASSERT_EQUAL(0, decoder.corruptFrames);
+}
+
+void test_bad_length_does_not_stall_next_frame()
+{
+  ResponseDecoder decoder;
+
+  // Claims 200 body bytes, only 2 ever arrive
+  receive(decoder, {0x55, 0x55, 0xD3, 200, 0x00, 0x10});
+  TEST_ASSERT_EQUAL(0, decoder.process(collectResponse));
+
+  receive(decoder, frame(0xD3, {0x00, 0x20}));
+  receive(decoder, frame(0xA3, {0x01}));
+  TEST_ASSERT_EQUAL(2, decoder.process(collectResponse));
+
+  TEST_ASSERT_EQUAL(2, responses.size());
+  TEST_ASSERT_TRUE((responses[0] == Bytes{0xD3, 0x00, 0x20}));
+  TEST_ASSERT_TRUE((responses[1] == Bytes{0xA3, 0x01}));
+  TEST_ASSERT_EQUAL(1, decoder.corruptFrames);
+  TEST_ASSERT_EQUAL(6, decoder.bytesDiscarded);
+}
+
+// Start bytes inside a body that is still arriving are not a reason to give up
+void test_start_bytes_in_partial_body_are_kept()
+{
+  ResponseDecoder decoder;
+  Bytes response = frame(0xB3, {0x55, 0x55, 0x01, 0x02, 0x55, 0x55});
+
+  receive(decoder, Bytes(response.begin(), response.end() - 3));
+  TEST_ASSERT_EQUAL(0, decoder.process(collectResponse));
+
+  receive(decoder, Bytes(response.end() - 3, response.end()));
+  TEST_ASSERT_EQUAL(1, decoder.process(collectResponse));
+  TEST_ASSERT_EQUAL(0, decoder.corruptFrames);
+}
+
+void test_noise_before_frame_is_discarded()
+{
+  ResponseDecoder decoder;
+  Bytes bytes = {0x00, 0x55, 0xAA};
+  Bytes status = frame(0xA3, {0x02});
+  bytes.insert(bytes.end(), status.begin(), status.end());
+
+  receive(decoder, bytes);
+  TEST_ASSERT_EQUAL(1, decoder.process(collectResponse));
+  TEST_ASSERT_EQUAL(3, decoder.bytesDiscarded);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_frame_split_across_notifications);
+  RUN_TEST(test_bad_length_does_not_stall_next_frame);
+  RUN_TEST(test_start_bytes_in_partial_body_are_kept);
+  RUN_TEST(test_noise_before_frame_is_discarded);
+  return UNITY_END();
+}
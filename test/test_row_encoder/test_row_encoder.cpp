@@ -0,0 +1,246 @@
+#include <string.h>
+
+#include <vector>
+
+#include <unity.h>
+
+#include "RowEncoder.h"
+
+typedef std::vector<uint8_t> Bytes;
+
+static std::vector<Bytes> frames;
+
+static void collectFrame(const PrinterFrame &frame, void *)
+{
+  frames.push_back(Bytes(frame.data(), frame.data() + frame.size()));
+}
+
+// Framed by hand rather than through PrinterFrame, so a framing bug there
+// can't hide one here
+static Bytes expectedFrame(uint8_t code, const Bytes &body)
+{
+  Bytes frame = {0x55, 0x55, code, static_cast<uint8_t>(body.size())};
+  uint8_t checksum = code ^ static_cast<uint8_t>(body.size());
+
+  for (uint8_t value : body)
+  {
+    frame.push_back(value);
+    checksum ^= value;
+  }
+
+  frame.push_back(checksum);
+  frame.push_back(0xAA);
+  frame.push_back(0xAA);
+  return frame;
+}
+
+static void assertFrame(const Bytes &expected, const Bytes &actual)
+{
+  TEST_ASSERT_EQUAL(expected.size(), actual.size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected.data(), actual.data(), expected.size());
+}
+
+void setUp()
+{
+  frames.clear();
+}
+
+void tearDown() {}
+
+void test_sparse_row_is_sent_as_pixel_indexes()
+{
+  RowEncoder encoder(collectFrame, nullptr);
+  uint8_t row[RowEncoder::PRINT_HEAD_BYTES] = {};
+
+  // One pixel in each head segment: 0, 167 and 377
+  row[0] = 0x80;
+  row[20] = 0x01;
+  row[47] = 0x40;
+
+  encoder.begin(0x0102);
+  encoder.addRow(row, sizeof(row));
+  encoder.finish();
+
+  TEST_ASSERT_EQUAL(1, frames.size());
+  assertFrame(expectedFrame(0x83, {0x01, 0x02, 1, 1, 1, 1, 0x00, 0x00, 0x00, 0xA7, 0x01, 0x79}), frames[0]);
+  TEST_ASSERT_EQUAL(1, encoder.indexedFrames);
+  TEST_ASSERT_EQUAL(sizeof(row) - 6, encoder.bytesSaved);
+}
+
+void test_dense_row_is_sent_as_bitmap()
+{
+  RowEncoder encoder(collectFrame, nullptr);
+  uint8_t row[RowEncoder::PRINT_HEAD_BYTES];
+  memset(row, 0x0F, sizeof(row));
+
+  encoder.begin(7);
+  encoder.addRow(row, sizeof(row));
+  encoder.finish();
+
+  Bytes body(row, row + sizeof(row));
+  body.insert(body.begin(), {0x00, 0x07, 64, 64, 64, 1});
+
+  TEST_ASSERT_EQUAL(1, frames.size());
+  assertFrame(expectedFrame(0x85, body), frames[0]);
+  TEST_ASSERT_EQUAL(1, encoder.bitmapFrames);
+}
+
+// Indexes only win when strictly smaller than the bitmap
+void test_equal_sizes_prefer_bitmap()
+{
+  RowEncoder encoder(collectFrame, nullptr);
+  const uint8_t row[8] = {0x81, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x81};
+
+  encoder.addRow(row, sizeof(row));
+  encoder.finish();
+
+  TEST_ASSERT_EQUAL(1, frames.size());
+  TEST_ASSERT_EQUAL(0x85, frames[0][2]);
+}
+
+void test_blank_rows_merge_into_whitespace()
+{
+  RowEncoder encoder(collectFrame, nullptr);
+  const uint8_t blank[RowEncoder::PRINT_HEAD_BYTES] = {};
+
+  encoder.begin(10);
+  encoder.addBlankRows(2);
+  encoder.addRow(blank, sizeof(blank));
+  encoder.addBlankRows(1);
+  encoder.finish();
+
+  TEST_ASSERT_EQUAL(1, frames.size());
+  assertFrame(expectedFrame(0x84, {0x00, 0x0A, 4}), frames[0]);
+  TEST_ASSERT_EQUAL(14, encoder.nextRow());
+  TEST_ASSERT_EQUAL(4, encoder.blankRows);
+}
+
+void test_repeats_split_at_255()
+{
+  RowEncoder encoder(collectFrame, nullptr);
+  const uint8_t row[4] = {0xFF, 0xFF, 0xFF, 0xFF};
+
+  for (int i = 0; i < 300; ++i)
+  {
+    encoder.addRow(row, sizeof(row));
+  }
+
+  encoder.addBlankRows(600);
+  encoder.finish();
+
+  TEST_ASSERT_EQUAL(5, frames.size());
+  assertFrame(expectedFrame(0x85, {0x00, 0x00, 32, 0, 0, 255, 0xFF, 0xFF, 0xFF, 0xFF}), frames[0]);
+  assertFrame(expectedFrame(0x85, {0x00, 0xFF, 32, 0, 0, 45, 0xFF, 0xFF, 0xFF, 0xFF}), frames[1]);
+  assertFrame(expectedFrame(0x84, {0x01, 0x2C, 255}), frames[2]);
+  assertFrame(expectedFrame(0x84, {0x02, 0x2B, 255}), frames[3]);
+  assertFrame(expectedFrame(0x84, {0x03, 0x2A, 90}), frames[4]);
+}
+
+void test_changed_row_starts_a_new_frame()
+{
+  RowEncoder encoder(collectFrame, nullptr);
+  const uint8_t first[2] = {0xFF, 0xFF};
+  const uint8_t second[2] = {0xFF, 0xFE};
+
+  encoder.addRow(first, sizeof(first));
+  encoder.addRow(first, sizeof(first));
+  encoder.addRow(second, sizeof(second));
+  encoder.finish();
+
+  TEST_ASSERT_EQUAL(2, frames.size());
+  assertFrame(expectedFrame(0x85, {0x00, 0x00, 16, 0, 0, 2, 0xFF, 0xFF}), frames[0]);
+  assertFrame(expectedFrame(0x85, {0x00, 0x02, 15, 0, 0, 1, 0xFF, 0xFE}), frames[1]);
+}
+
+static void countSlowly(const uint8_t *row, size_t length, uint16_t (&segments)[RowEncoder::SEGMENT_COUNT], uint16_t &total)
+{
+  memset(segments, 0, sizeof(segments));
+  total = 0;
+
+  for (size_t i = 0; i < length; ++i)
+  {
+    for (int bit = 0; bit < 8; ++bit)
+    {
+      if (row[i] & (1 << bit))
+      {
+        ++total;
+
+        if (i < RowEncoder::PRINT_HEAD_BYTES)
+        {
+          ++segments[i / RowEncoder::SEGMENT_BYTES];
+        }
+      }
+    }
+  }
+}
+
+void test_segment_counts_match_every_length()
+{
+  uint8_t row[RowEncoder::MAX_ROW_BYTES];
+
+  for (size_t i = 0; i < sizeof(row); ++i)
+  {
+    row[i] = static_cast<uint8_t>(i * 37 + 11);
+  }
+
+  for (size_t length = 0; length <= sizeof(row); ++length)
+  {
+    uint8_t pixelCounts[RowEncoder::SEGMENT_COUNT];
+    uint16_t segments[RowEncoder::SEGMENT_COUNT];
+    uint16_t total;
+
+    countSlowly(row, length, segments, total);
+    TEST_ASSERT_EQUAL(total, RowEncoder::countBlackPixels(row, length, pixelCounts));
+
+    if (length <= RowEncoder::PRINT_HEAD_BYTES)
+    {
+      TEST_ASSERT_EQUAL(segments[0], pixelCounts[0]);
+      TEST_ASSERT_EQUAL(segments[1], pixelCounts[1]);
+      TEST_ASSERT_EQUAL(segments[2], pixelCounts[2]);
+    }
+    else
+    {
+      TEST_ASSERT_EQUAL(0, pixelCounts[0]);
+      TEST_ASSERT_EQUAL(total >> 8, pixelCounts[1]);
+      TEST_ASSERT_EQUAL(total & 0xFF, pixelCounts[2]);
+    }
+  }
+}
+
+// The counts in an emitted frame are the ones countBlackPixels reports
+void test_frame_carries_segment_counts()
+{
+  RowEncoder encoder(collectFrame, nullptr);
+  uint8_t row[RowEncoder::PRINT_HEAD_BYTES];
+
+  for (size_t i = 0; i < sizeof(row); ++i)
+  {
+    row[i] = static_cast<uint8_t>(i < 16 ? 0x01 : (i < 32 ? 0x33 : 0xFF));
+  }
+
+  uint8_t pixelCounts[RowEncoder::SEGMENT_COUNT];
+  RowEncoder::countBlackPixels(row, sizeof(row), pixelCounts);
+
+  encoder.addRow(row, sizeof(row));
+  encoder.finish();
+
+  TEST_ASSERT_EQUAL(1, frames.size());
+  TEST_ASSERT_EQUAL(16, pixelCounts[0]);
+  TEST_ASSERT_EQUAL(64, pixelCounts[1]);
+  TEST_ASSERT_EQUAL(128, pixelCounts[2]);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(pixelCounts, &frames[0][6], RowEncoder::SEGMENT_COUNT);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_sparse_row_is_sent_as_pixel_indexes);
+  RUN_TEST(test_dense_row_is_sent_as_bitmap);
+  RUN_TEST(test_equal_sizes_prefer_bitmap);
+  RUN_TEST(test_blank_rows_merge_into_whitespace);
+  RUN_TEST(test_repeats_split_at_255);
+  RUN_TEST(test_changed_row_starts_a_new_frame);
+  RUN_TEST(test_segment_counts_match_every_length);
+  RUN_TEST(test_frame_carries_segment_counts);
+  return UNITY_END();
+}